@@ -1,9 +1,9 @@
 # Source files common to all architectures
 COMMON_SRCS = main.c \
 	mem.c malloc.c string.c \
-	thread.c synch.c workqueue.c \
+	thread.c synch.c kwait.c softirq.c irq.c rcu.c poll.c workqueue.c threadpool.c \
 	dev.c blockdev.c range.c lba.c \
-	cons.c timer.c ramdisk.c \
-	vfs.c pfat.c \
+	cons.c timer.c ktime.c ramdisk.c \
+	vfs.c file.c pfat.c \
 	vm.c keyboard.c \
 	blockdev_pager.c
@@ -0,0 +1,53 @@
+/*
+ * GeekOS - atomic operations
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef GEEKOS_ATOMIC_H
+#define GEEKOS_ATOMIC_H
+
+/*
+ * The architecture provides:
+ *
+ *   atomic_cmpxchg(p, old, new) - if *p == old, store new; returns old value of *p
+ *   atomic_xchg(p, val)         - store val, returns old value of *p
+ *   atomic_add_return(p, delta) - add delta, returns the new value of *p
+ *   atomic_inc(p), atomic_dec(p)
+ *   mem_barrier()               - full memory barrier
+ *   compiler_barrier()          - prevent compiler reordering only
+ *   write_barrier()             - order stores before later stores
+ *   read_barrier()              - order loads before later loads
+ *
+ * All of these operate on naturally aligned 32 bit words.
+ */
+
+#include <geekos/types.h>
+#include <arch/atomic.h>
+
+/*
+ * Publish a pointer to an initialized object, so that a lockless
+ * reader which sees the pointer also sees the object's contents.
+ */
+#define rcu_assign_pointer(p, v) \
+do { write_barrier(); (p) = (v); } while (0)
+
+/* Load a pointer published with rcu_assign_pointer(). */
+#define rcu_dereference(p) \
+({ __typeof__(p) rcu_p__ = *(__typeof__(p) volatile *) &(p); read_barrier(); rcu_p__; })
+
+#endif /* ifndef GEEKOS_ATOMIC_H */
@@ -23,6 +23,8 @@
 #include <geekos/types.h>
 #include <geekos/thread.h>
 #include <geekos/lba.h>
+#include <geekos/workqueue.h>
+#include <geekos/poll.h>
 
 /* request type */
 typedef enum { BLOCKDEV_REQ_READ, BLOCKDEV_REQ_WRITE } blockdev_req_type_t;
@@ -43,8 +45,10 @@ struct blockdev_req {
 	blockdev_req_state_t state;    /* state of request */
 	int rc;                        /* return code (when request completes) */
 	struct thread_queue waitqueue; /* queue in which to wait for completion */
+	struct poll_waitqueue poll_waitqueue; /* poll sets waiting for completion */
 	struct blockdev *dev;          /* the block device */
 	void *data;                    /* scratch pointer for use by driver */
+	struct work work;              /* work item for use by driver */
 };
 
 /*
@@ -69,6 +73,7 @@ struct blockdev {
 struct blockdev_req *blockdev_create_request(lba_t lba, unsigned num_blocks, void *buf, blockdev_req_type_t type);
 void blockdev_post_request(struct blockdev *dev, struct blockdev_req *req);
 int blockdev_wait_for_completion(struct blockdev_req *req);
+unsigned blockdev_req_poll(void *req, struct poll_table *pt);
 int blockdev_post_and_wait(struct blockdev *dev, struct blockdev_req *req);
 void blockdev_notify_complete(struct blockdev_req *req, int rc);
 
@@ -29,6 +29,10 @@
 #define ENODEV -5      /* no such device */
 #define EIO -6         /* input/output error */
 #define ENOTSUP -7     /* operation not supported */
+#define ETIMEDOUT -8   /* timed out */
+#define EAGAIN -9      /* try again */
+#define EMFILE -10     /* too many open files */
+#define EBADF -11      /* bad file descriptor */
 
 #endif
 
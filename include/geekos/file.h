@@ -0,0 +1,90 @@
+/*
+ * GeekOS - open files and file descriptors
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef GEEKOS_FILE_H
+#define GEEKOS_FILE_H
+
+#ifdef KERNEL
+
+#include <geekos/types.h>
+#include <geekos/synch.h>
+#include <geekos/workqueue.h>
+
+struct inode;
+
+/* open modes */
+#define VFS_OPEN_READ   (1 << 0)
+#define VFS_OPEN_WRITE  (1 << 1)
+
+/* maximum number of pages read ahead of a sequential reader */
+#define VFS_READAHEAD_MAX 8
+
+/*
+ * An open file.  vfs_pread() and vfs_pwrite() do not use the
+ * file position, so threads doing I/O at different offsets
+ * in the same file do not serialize on the file.
+ */
+struct file {
+	struct inode *inode;          /* the file's inode (we hold a reference) */
+	int mode;                     /* VFS_OPEN_xxx flags */
+	struct mutex pos_lock;        /* serializes I/O which uses pos */
+	ulong_t pos;                  /* position for vfs_file_read()/vfs_file_write() */
+
+	/*
+	 * Readahead state.  It is only a hint, so concurrent
+	 * readers update it without locking.
+	 */
+	u32_t ra_next_page;           /* first page of the next sequential read */
+	unsigned ra_window;           /* pages to read ahead (0 if not sequential) */
+	u32_t ra_start;               /* first page for ra_work to read */
+	unsigned ra_count;            /* number of pages for ra_work to read */
+	struct work ra_work;          /* reads pages ahead in the background */
+};
+
+/*
+ * A thread's table of open files, indexed by file descriptor.
+ * Free descriptors are linked through next_free, so allocating
+ * and freeing a descriptor is O(1).  Only the owning thread
+ * uses its table, so it needs no locking.
+ */
+#define FD_TABLE_SIZE 32
+
+struct fd_table {
+	struct file *files[FD_TABLE_SIZE];
+	int next_free[FD_TABLE_SIZE]; /* next free descriptor (-1 at end of list) */
+	int free_head;                /* first free descriptor (-1 if none) */
+};
+
+int vfs_open(const char *path, int mode, struct file **p_file);
+int vfs_file_close(struct file *file);
+int vfs_pread(struct file *file, void *buf, size_t len, ulong_t offset);
+int vfs_pwrite(struct file *file, void *buf, size_t len, ulong_t offset);
+int vfs_file_read(struct file *file, void *buf, size_t len);
+int vfs_file_write(struct file *file, void *buf, size_t len);
+void vfs_seek(struct file *file, ulong_t pos);
+
+int fd_install(struct file *file);
+struct file *fd_get(int fd);
+int fd_close(int fd);
+void fd_table_destroy(struct fd_table *table);
+
+#endif /* ifdef KERNEL */
+
+#endif /* ifndef GEEKOS_FILE_H */
@@ -23,6 +23,7 @@
 
 #include <geekos/types.h>
 #include <geekos/kassert.h>
+#include <geekos/percpu.h>
 
 #ifndef ASM
 
@@ -34,12 +35,18 @@ struct thread_context;
  */
 typedef void (int_handler_t)(struct thread_context *tcontext);
 
+/* interrupt handler nesting depth on this CPU */
+DECLARE_PERCPU(int, g_int_nesting);
+/* top of this CPU's interrupt stack */
+DECLARE_PERCPU(ulong_t, g_int_stack_top);
+
 /* architecture-dependent functions */
 void int_init(void);
 void int_install_handler(int int_num, int_handler_t *handler);
 bool int_enabled(void);
 void int_enable__(void);
 void int_disable__(void);
+void int_wait__(void);
 
 /* enable and disable interrupts (detecting improper nesting) */
 #define int_enable() \
@@ -47,6 +54,10 @@ do { KASSERT(!int_enabled()); int_enable__(); } while (0)
 #define int_disable() \
 do { KASSERT(int_enabled()); int_disable__(); } while (0)
 
+/* atomically enable interrupts and halt until one arrives */
+#define int_wait() \
+do { KASSERT(!int_enabled()); int_wait__(); } while (0)
+
 /* Support for int-atomic regions */
 static __inline__ bool int_begin_atomic(void)
 {
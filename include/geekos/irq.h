@@ -25,6 +25,18 @@
 #include <geekos/thread.h>
 #include <arch/irq.h>
 
+/*
+ * Threaded IRQ handling: the top half runs in the interrupt handler
+ * and returns true if the IRQ thread should be woken.  While the
+ * thread function runs, the IRQ is masked.
+ */
+typedef bool (irq_top_half_t)(int irq, void *data);
+typedef void (irq_thread_func_t)(int irq, void *data);
+
+/* Generic functions */
+int irq_request_threaded(int irq, irq_top_half_t *top_half,
+	irq_thread_func_t *thread_func, void *data, int priority);
+
 /* Architecture-dependent functions */
 void irq_init(void);
 void irq_install_handler(int irq, int_handler_t *handler);
@@ -34,5 +46,6 @@ void irq_enable(int irq);
 void irq_disable(int irq);
 void irq_begin(struct thread_context *context);
 void irq_end(struct thread_context *context);
+int irq_get_number(struct thread_context *context);
 
 #endif /* GEEKOS_IRQ_H */
@@ -13,14 +13,18 @@
 #define GEEKOS_KEYBOARD_H
 
 #include <geekos/types.h>
+#include <geekos/poll.h>
 #include <arch/keyboard.h>
 
 /* Wait queue for thread(s) waiting for keyboard events. */
 extern struct thread_queue s_waitqueue;
+/* Poll wait queue for poll sets waiting for keyboard events. */
+extern struct poll_waitqueue s_poll_waitqueue;
 
 /* public functions */
 void keyboard_init(void);
 bool read_key(u16_t* keycode);
 u16_t wait_for_key(void);
+unsigned keyboard_poll(void *obj, struct poll_table *pt);
 
 #endif  /* GEEKOS_KEYBOARD_H */
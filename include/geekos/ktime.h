@@ -0,0 +1,69 @@
+/*
+ * GeekOS - kernel time and clocksources
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef GEEKOS_KTIME_H
+#define GEEKOS_KTIME_H
+
+#include <geekos/types.h>
+
+/* monotonic time in nanoseconds since ktime_init() */
+typedef s64_t ktime_t;
+
+#define NSEC_PER_USEC 1000L
+#define NSEC_PER_MSEC 1000000L
+#define NSEC_PER_SEC  1000000000L
+
+/*
+ * A clocksource is a free-running counter.
+ * Cycle counts are converted to nanoseconds as
+ * (cycles * mult) >> shift.
+ */
+struct clocksource {
+	const char *name;
+	u64_t (*read)(struct clocksource *cs); /* read the counter */
+	u64_t mask;                 /* mask for counter width (handles wraparound) */
+	u32_t mult;                 /* cycle to ns multiplier */
+	u32_t shift;                /* cycle to ns shift */
+	int rating;                 /* higher is better */
+	bool unstable;              /* set when the watchdog finds it unreliable */
+	struct clocksource *next;
+};
+
+void ktime_init(void);
+ktime_t ktime_get(void);
+
+void clocksource_set_freq_khz(struct clocksource *cs, u32_t khz);
+void clocksource_register(struct clocksource *cs);
+void clocksource_mark_unstable(struct clocksource *cs);
+struct clocksource *clocksource_current(void);
+
+/*
+ * Convert a cycle count (a difference between two readings
+ * of given clocksource) to nanoseconds.
+ */
+static __inline__ u64_t clocksource_cyc2ns(struct clocksource *cs, u64_t cycles)
+{
+	return (cycles * cs->mult) >> cs->shift;
+}
+
+/* architecture-dependent functions */
+void clocksource_arch_init(void);
+
+#endif /* ifndef GEEKOS_KTIME_H */
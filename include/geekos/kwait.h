@@ -0,0 +1,46 @@
+/*
+ * GeekOS - wait on address
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef GEEKOS_KWAIT_H
+#define GEEKOS_KWAIT_H
+
+/*
+ * Wait on address: threads sleep on the address of a word, in
+ * one of a fixed number of hashed wait queues, so objects built
+ * on it need no thread queue of their own.  kwait() sleeps only if
+ * the word still holds the expected value, and the check is atomic
+ * with respect to kwake(), so a wakeup is never lost between the
+ * check and the sleep.  For example, a one-shot event:
+ *
+ *   wait:   while (ev == 0) kwait(&ev, 0);
+ *   signal: ev = 1; kwake(&ev, KWAKE_ALL);
+ *
+ * kwake() may be called from interrupt handlers.
+ */
+
+#include <geekos/types.h>
+
+#define KWAKE_ALL  0x7fffffff
+
+int kwait(volatile ulong_t *addr, ulong_t expected);
+int kwait_timeout(volatile ulong_t *addr, ulong_t expected, u32_t ticks);
+int kwake(volatile ulong_t *addr, int count);
+
+#endif /* ifndef GEEKOS_KWAIT_H */
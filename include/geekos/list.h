@@ -22,6 +22,7 @@
 
 #include <geekos/types.h>
 #include <geekos/kassert.h>
+#include <geekos/atomic.h>
 
 /*
  * Declare a list structure and prototypes for the list accessor
@@ -44,7 +45,12 @@ struct node_type *list_type##_remove_last(struct list_type *list); \
 struct node_type *list_type##_remove_first(struct list_type *list); \
 void list_type##_remove(struct list_type *list, struct node_type *node); \
 struct node_type *list_type##_next(struct node_type *node); \
-struct node_type *list_type##_prev(struct node_type *node)
+struct node_type *list_type##_prev(struct node_type *node); \
+void list_type##_append_rcu(struct list_type *list, struct node_type *node); \
+void list_type##_prepend_rcu(struct list_type *list, struct node_type *node); \
+void list_type##_remove_rcu(struct list_type *list, struct node_type *node); \
+struct node_type *list_type##_get_first_rcu(struct list_type *list); \
+struct node_type *list_type##_next_rcu(struct node_type *node)
 
 /*
  * Define the link fields for given list/node type.
@@ -207,4 +213,82 @@ IMPLEMENT_LIST_REMOVE(list_type, node_type) \
 IMPLEMENT_LIST_NEXT(list_type, node_type) \
 IMPLEMENT_LIST_PREV(list_type, node_type)
 
+/*
+ * RCU variants.  Updaters (serialized among themselves by a lock)
+ * use the _rcu append/prepend/remove functions, which publish new
+ * nodes only once they are linked, and leave a removed node's
+ * forward link intact for readers still traversing it.  Readers, in
+ * an rcu_read_lock() section, traverse forward with get_first_rcu
+ * and next_rcu.  A removed node may only be freed after a grace
+ * period (see <geekos/rcu.h>).
+ */
+
+/* Define implementation of list_type##_append_rcu function */
+#define IMPLEMENT_LIST_APPEND_RCU(list_type, node_type) \
+void list_type##_append_rcu(struct list_type *list, struct node_type *node) \
+{ \
+	node->list_type##_next = 0; \
+	node->list_type##_prev = list->tail; \
+	if (list->head == 0) { \
+		list->tail = node; \
+		rcu_assign_pointer(list->head, node); \
+	} else { \
+		rcu_assign_pointer(list->tail->list_type##_next, node); \
+		list->tail = node; \
+	} \
+}
+
+/* Define implementation of list_type##_prepend_rcu function */
+#define IMPLEMENT_LIST_PREPEND_RCU(list_type, node_type) \
+void list_type##_prepend_rcu(struct list_type *list, struct node_type *node) \
+{ \
+	node->list_type##_prev = 0; \
+	node->list_type##_next = list->head; \
+	if (list->head == 0) { \
+		list->tail = node; \
+	} else { \
+		list->head->list_type##_prev = node; \
+	} \
+	rcu_assign_pointer(list->head, node); \
+}
+
+/* Define implementation of list_type##_remove_rcu function */
+#define IMPLEMENT_LIST_REMOVE_RCU(list_type, node_type) \
+void list_type##_remove_rcu(struct list_type *list, struct node_type *node) \
+{ \
+	if (node->list_type##_prev != 0) { \
+		node->list_type##_prev->list_type##_next = node->list_type##_next; \
+	} else { \
+		list->head = node->list_type##_next; \
+	} \
+	if (node->list_type##_next != 0) { \
+		node->list_type##_next->list_type##_prev = node->list_type##_prev; \
+	} else { \
+		list->tail = node->list_type##_prev; \
+	} \
+	/* node->next is left alone: readers may still be on this node */ \
+}
+
+/* Define implementation of list_type##_get_first_rcu function */
+#define IMPLEMENT_LIST_GET_FIRST_RCU(list_type, node_type) \
+struct node_type *list_type##_get_first_rcu(struct list_type *list) \
+{ \
+	return rcu_dereference(list->head); \
+}
+
+/* Define implementation of list_type##_next_rcu function */
+#define IMPLEMENT_LIST_NEXT_RCU(list_type, node_type) \
+struct node_type *list_type##_next_rcu(struct node_type *node) \
+{ \
+	return rcu_dereference(node->list_type##_next); \
+}
+
+/* Define implementations of all RCU list functions */
+#define IMPLEMENT_LIST_RCU(list_type, node_type) \
+IMPLEMENT_LIST_APPEND_RCU(list_type, node_type) \
+IMPLEMENT_LIST_PREPEND_RCU(list_type, node_type) \
+IMPLEMENT_LIST_REMOVE_RCU(list_type, node_type) \
+IMPLEMENT_LIST_GET_FIRST_RCU(list_type, node_type) \
+IMPLEMENT_LIST_NEXT_RCU(list_type, node_type)
+
 #endif /* GEEKOS_LIST_H */
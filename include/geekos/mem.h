@@ -66,6 +66,18 @@ struct frame {
 	int errc;                 /* error code if content == PAGE_FAILED_INIT */
 };
 
+/*
+ * A shrinker releases memory held by a cache when an allocation
+ * cannot be satisfied.  The shrink function is called with
+ * interrupts disabled and must not block; it should free up to
+ * nr_to_free objects and return the number actually freed.
+ */
+struct mem_shrinker {
+	const char *name;
+	int (*shrink)(struct mem_shrinker *shrinker, int nr_to_free);
+	struct mem_shrinker *next;
+};
+
 void mem_clear_bss(void);
 void mem_init(struct multiboot_info *boot_record);
 void *mem_alloc(size_t size);
@@ -80,6 +92,9 @@ struct frame *mem_pa_to_frame(void *pa);
 ulong_t mem_round_to_page(ulong_t addr);
 bool mem_is_page_aligned(ulong_t addr);
 
+void mem_register_shrinker(struct mem_shrinker *shrinker);
+int mem_shrink(int nr_to_free);
+
 /* architecture-dependent initialization */
 
 typedef ulong_t (scan_reg_func_t)(ulong_t start_addr, ulong_t end_addr,
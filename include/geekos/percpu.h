@@ -0,0 +1,54 @@
+/*
+ * GeekOS - per-CPU data
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef GEEKOS_PERCPU_H
+#define GEEKOS_PERCPU_H
+
+/*
+ * Per-CPU variables are defined with DEFINE_PERCPU, which places
+ * them in the percpu_data section.  The copy of the section
+ * linked into the kernel image belongs to the boot CPU; every
+ * other CPU gets its own copy.  Per-CPU variables must only be
+ * accessed through the percpu_*() accessors, which address the
+ * executing CPU's copy through a segment register.
+ */
+
+#ifndef ASM
+
+#include <geekos/types.h>
+
+#define PERCPU_SECTION "percpu_data"
+
+/* Define a per-CPU variable */
+#define DEFINE_PERCPU(type, name) \
+	__attribute__((section(PERCPU_SECTION))) __typeof__(type) name
+
+/* Declare a per-CPU variable defined in another module */
+#define DECLARE_PERCPU(type, name) \
+	extern __typeof__(type) name
+
+/* number of CPUs which have a per-CPU data area */
+extern int g_num_cpus;
+
+#endif /* ifndef ASM */
+
+#include <arch/percpu.h>
+
+#endif /* ifndef GEEKOS_PERCPU_H */
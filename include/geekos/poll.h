@@ -0,0 +1,118 @@
+/*
+ * GeekOS - waiting for multiple events
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef GEEKOS_POLL_H
+#define GEEKOS_POLL_H
+
+/*
+ * Poll sets let one thread wait for events from several sources.
+ *
+ * An event source (a device, a request, ...) embeds a
+ * struct poll_waitqueue, calls poll_wakeup() when it becomes ready,
+ * and provides a readiness callback:
+ *
+ *   unsigned my_poll(void *obj, struct poll_table *pt)
+ *   {
+ *           poll_wait(pt, &my->poll_waitqueue);
+ *           return my_is_ready(my) ? POLLIN : 0;
+ *   }
+ *
+ * The callback is called with interrupts disabled and must not block.
+ *
+ * A thread adds a struct poll_item for each source to a poll set,
+ * and calls poll_set_wait(), which returns once at least one item
+ * is ready.  A level-triggered item is ready whenever its callback
+ * reports one of the requested events; an edge-triggered item
+ * (POLLET) is ready only if the source called poll_wakeup() with
+ * one of the requested events since the item was last reported.
+ */
+
+#include <geekos/types.h>
+#include <geekos/list.h>
+#include <geekos/thread.h>
+
+/* event bits */
+#define POLLIN   (1U << 0)   /* data available */
+#define POLLOUT  (1U << 1)   /* ready for output */
+#define POLLERR  (1U << 2)   /* error condition */
+#define POLLET   (1U << 31)  /* edge-triggered (in poll_item.events only) */
+
+/* timeout for poll_set_wait() which never expires */
+#define POLL_INFINITE (~0U)
+
+DECLARE_LIST(poll_wq_list, poll_item);
+DECLARE_LIST(poll_set_list, poll_item);
+
+struct poll_item;
+struct poll_table;
+
+typedef unsigned (poll_func_t)(void *obj, struct poll_table *pt);
+
+/*
+ * Wait queue of an event source: the items registered on it.
+ */
+struct poll_waitqueue {
+	struct poll_wq_list items;
+};
+
+/*
+ * Passed to a readiness callback when an item is added to a poll set,
+ * so that the callback can register it with poll_wait().
+ */
+struct poll_table {
+	struct poll_item *item;
+};
+
+/*
+ * One event source in a poll set.
+ */
+struct poll_item {
+	poll_func_t *poll;              /* readiness callback */
+	void *obj;                      /* event source, passed to the callback */
+	unsigned events;                /* requested events (and POLLET) */
+	unsigned revents;               /* events reported by poll_set_wait() */
+	unsigned pending;               /* events signaled since last reported */
+	struct poll_set *set;           /* poll set the item belongs to */
+	struct poll_waitqueue *pwq;     /* wait queue the item is registered on */
+	DEFINE_LINK(poll_wq_list, poll_item);
+	DEFINE_LINK(poll_set_list, poll_item);
+};
+
+/*
+ * A set of items a thread waits on.
+ */
+struct poll_set {
+	struct poll_set_list items;
+	struct thread_queue waitqueue;
+};
+
+/* For event sources */
+void poll_waitqueue_init(struct poll_waitqueue *pwq);
+void poll_wait(struct poll_table *pt, struct poll_waitqueue *pwq);
+void poll_wakeup(struct poll_waitqueue *pwq, unsigned events);
+
+/* For waiters */
+void poll_item_init(struct poll_item *item, poll_func_t *poll, void *obj, unsigned events);
+void poll_set_init(struct poll_set *set);
+void poll_set_add(struct poll_set *set, struct poll_item *item);
+void poll_set_remove(struct poll_set *set, struct poll_item *item);
+int poll_set_wait(struct poll_set *set, u32_t ticks);
+
+#endif /* ifndef GEEKOS_POLL_H */
@@ -28,6 +28,7 @@ unsigned range_umax(unsigned a, unsigned b);
 bool range_is_valid_u32(u32_t start, u32_t num, u32_t total);
 int range_bit_count(unsigned val);
 bool range_is_power_of_two(unsigned val);
+u64_t range_div_u64_u32(u64_t dividend, u32_t divisor);
 
 #endif /* RANGE_H */
 
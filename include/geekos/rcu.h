@@ -0,0 +1,66 @@
+/*
+ * GeekOS - read-copy-update (RCU)
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef GEEKOS_RCU_H
+#define GEEKOS_RCU_H
+
+/*
+ * Read-copy-update: readers traverse shared data without locks,
+ * inside rcu_read_lock()/rcu_read_unlock(), which only disable
+ * preemption.  Updaters publish new versions with
+ * rcu_assign_pointer() (or the _rcu list functions in <geekos/list.h>),
+ * and free old versions only after a grace period, once every CPU
+ * has passed through a quiescent state (a context switch, or a
+ * timer tick which interrupted preemptible code) and so cannot
+ * still be in a read-side critical section which saw them.
+ *
+ * Readers must not block.
+ */
+
+#include <geekos/types.h>
+#include <geekos/thread.h>
+
+/*
+ * Callback for deferred reclamation, usually embedded in the
+ * object to be freed.
+ */
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+static __inline__ void rcu_read_lock(void)
+{
+	preempt_disable();
+}
+
+static __inline__ void rcu_read_unlock(void)
+{
+	preempt_enable();
+}
+
+void rcu_init(void);
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head));
+void synchronize_rcu(void);
+
+/* Called by the scheduler and timer to report quiescent states. */
+void rcu_note_quiescent_state(void);
+
+#endif /* ifndef GEEKOS_RCU_H */
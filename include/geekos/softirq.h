@@ -0,0 +1,79 @@
+/*
+ * GeekOS - softirqs and tasklets
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef GEEKOS_SOFTIRQ_H
+#define GEEKOS_SOFTIRQ_H
+
+/*
+ * Softirqs are bottom halves: deferred interrupt work which runs
+ * on the way out of the outermost interrupt handler, with interrupts
+ * enabled.  An interrupt handler (the top half) does only what must
+ * be done with interrupts disabled, typically acknowledging the
+ * device and queuing data, and raises a softirq or schedules a
+ * tasklet for the rest.  Softirqs run in interrupt context, so they
+ * must not block.  If softirqs keep being raised, the excess is
+ * handed to the ksoftirqd thread so that threads are not starved.
+ */
+
+#include <geekos/types.h>
+#include <geekos/percpu.h>
+
+/* softirq numbers, in order of priority */
+enum {
+	SOFTIRQ_HI,       /* high-priority tasklets */
+	SOFTIRQ_TIMER,    /* expired kernel timers */
+	SOFTIRQ_TASKLET,  /* normal tasklets */
+	SOFTIRQ_RCU,      /* RCU callbacks */
+	SOFTIRQ_NUM
+};
+
+typedef void (softirq_action_t)(void);
+
+/* bitmask of softirqs raised on this CPU */
+DECLARE_PERCPU(u32_t, g_softirq_pending);
+/* nonzero while this CPU is running softirqs */
+DECLARE_PERCPU(int, g_in_softirq);
+
+/* tasklet states */
+#define TASKLET_SCHEDULED (1 << 0)
+#define TASKLET_RUNNING   (1 << 1)
+
+/*
+ * A tasklet is a dynamically schedulable bottom half.
+ * A given tasklet never runs concurrently with itself.
+ */
+struct tasklet {
+	void (*func)(ulong_t data);
+	ulong_t data;
+	volatile int state;
+	struct tasklet *next;
+};
+
+void softirq_init(void);
+void softirq_register(int nr, softirq_action_t *action);
+void softirq_raise(int nr);
+void softirq_irq_exit(void);
+bool softirq_in_interrupt(void);
+
+void tasklet_init(struct tasklet *tasklet, void (*func)(ulong_t), ulong_t data);
+void tasklet_schedule(struct tasklet *tasklet);
+void tasklet_hi_schedule(struct tasklet *tasklet);
+
+#endif /* ifndef GEEKOS_SOFTIRQ_H */
@@ -23,28 +23,115 @@
 
 #include <geekos/thread.h>
 
-typedef enum { MUTEX_UNLOCKED = 0, MUTEX_LOCKED = 1 } mutex_state_t;
+/*
+ * The mutex owner word holds a pointer to the owning thread (0 when
+ * unlocked), with MUTEX_WAITERS set when threads may be waiting in
+ * the wait queue.  Uncontended lock and unlock are a single
+ * compare-and-swap on this word.
+ *
+ * Mutexes implement priority inheritance: while a thread waits for
+ * a mutex, the owner (and, transitively, the owner of any mutex the
+ * owner is itself waiting for) runs at the waiter's priority at least.
+ */
+#define MUTEX_WAITERS   1UL
+#define MUTEX_OWNER(word) ((struct thread *) ((word) & ~MUTEX_WAITERS))
 
 struct mutex {
-	mutex_state_t state;
-	struct thread *owner;
+	volatile ulong_t owner;
 	struct thread_queue waitqueue;
+	bool pi_linked;                 /* on the owner's pi_mutexes list */
+	DEFINE_LINK(mutex_list, mutex);
 };
 
 struct condition {
 	struct thread_queue waitqueue;
 };
 
+/*
+ * Sleeping reader-writer lock.  Any number of readers, or one
+ * writer, may hold the lock.  Writers are preferred: once a writer
+ * is waiting, new readers wait too.  When a writer releases the
+ * lock, all waiting readers are admitted as one batch, so readers
+ * and writers alternate under contention.
+ */
+struct rwlock {
+	int readers;                    /* number of readers holding the lock */
+	struct thread *writer;          /* writer holding the lock (null if none) */
+	int readers_waiting;
+	int writers_waiting;
+	struct thread_queue read_waitqueue;
+	struct thread_queue write_waitqueue;
+};
+
+/*
+ * Sequence lock, for small read-mostly data.  Readers do not lock:
+ * they retry if a writer ran concurrently.  Writers disable
+ * interrupts, so they may be used from interrupt handlers,
+ * and readers never wait for a preempted writer.
+ *
+ *   do {
+ *           seq = read_seqbegin(&lock);
+ *           ...copy the data...
+ *   } while (read_seqretry(&lock, seq));
+ */
+struct seqlock {
+	volatile u32_t sequence;        /* odd while a write is in progress */
+};
+
 void mutex_init(struct mutex *mutex);
 void mutex_lock(struct mutex *mutex);
+bool mutex_trylock(struct mutex *mutex);
 void mutex_unlock(struct mutex *mutex);
 
 void cond_init(struct condition *cond);
 void cond_wait(struct condition *cond, struct mutex *mutex);
+int cond_timedwait(struct condition *cond, struct mutex *mutex, u32_t ticks);
 void cond_signal(struct condition *cond);
 void cond_broadcast(struct condition *cond);
 
+void rwlock_init(struct rwlock *rw);
+void rwlock_read_lock(struct rwlock *rw);
+void rwlock_read_unlock(struct rwlock *rw);
+void rwlock_write_lock(struct rwlock *rw);
+void rwlock_write_unlock(struct rwlock *rw);
+
+static __inline__ void seqlock_init(struct seqlock *sl)
+{
+	sl->sequence = 0;
+}
+
+static __inline__ u32_t read_seqbegin(struct seqlock *sl)
+{
+	u32_t seq;
+	while (((seq = sl->sequence) & 1) != 0) {
+		/* writer active on another CPU */
+	}
+	compiler_barrier();
+	return seq;
+}
+
+static __inline__ bool read_seqretry(struct seqlock *sl, u32_t start)
+{
+	compiler_barrier();
+	return sl->sequence != start;
+}
+
+static __inline__ bool write_seqlock(struct seqlock *sl)
+{
+	bool iflag = int_begin_atomic();
+	sl->sequence++;
+	compiler_barrier();
+	return iflag;
+}
+
+static __inline__ void write_sequnlock(struct seqlock *sl, bool iflag)
+{
+	compiler_barrier();
+	sl->sequence++;
+	int_end_atomic(iflag);
+}
+
 #define MUTEX_IS_HELD(mutex) \
-	((mutex)->state == MUTEX_LOCKED && (mutex)->owner == g_current)
+	(MUTEX_OWNER((mutex)->owner) == percpu_read(g_current))
 
 #endif /* ifndef GEEKOS_SYNCH_H */
@@ -29,18 +29,35 @@
 #include <arch/thread.h>
 #include <geekos/types.h>
 #include <geekos/list.h>
+#include <geekos/percpu.h>
+#include <geekos/atomic.h>
+#include <geekos/int.h>
+#include <geekos/kassert.h>
+#include <geekos/workqueue.h>
 
 struct thread;
 struct thread_context;
 struct process;
+struct threadpool_worker;
+struct workqueue_worker;
+struct fd_table;
 
 DECLARE_LIST(thread_queue, thread);
+DECLARE_LIST(mutex_list, mutex);
 
 /* thread states */
 typedef enum {
 	THREAD_READY, THREAD_RUNNING, THREAD_WAITING, THREAD_EXITED, THREAD_KILLED
 } thread_state_t;
 
+/* thread priorities: higher values are more important */
+#define THREAD_NUM_PRIORITIES 8
+#define THREAD_PRIO_MIN    0
+#define THREAD_PRIO_NORMAL 2
+#define THREAD_PRIO_HIGH   4
+#define THREAD_PRIO_IRQ    6
+#define THREAD_PRIO_MAX    (THREAD_NUM_PRIORITIES - 1)
+
 /* thread creation mode: "attached" means parent will wait for child to exit */
 typedef enum { THREAD_ATTACHED, THREAD_DETACHED } thread_mode_t;
 
@@ -51,18 +68,32 @@ struct thread {
 	ulong_t stack_ptr;		/* saved stack pointer (this must be the first field!) */
 	volatile u32_t num_ticks;       /* number of ticks thread has been running */
 	void *stack;                    /* kernel stack */
+	size_t stack_size;              /* size of kernel stack in bytes */
 	struct thread *parent;          /* parent thread */
 	struct process *proc;           /* process the thread belongs to (null for kernel-only) */
 	thread_state_t state;           /* state of thread in lifecycle */
+	int priority;                   /* effective scheduling priority (THREAD_PRIO_xxx) */
+	int base_priority;              /* priority set with thread_set_priority() */
+	int pi_priority;                /* highest priority of threads waiting for our mutexes */
+	struct mutex *blocked_on;       /* mutex the thread is waiting for (null if none) */
+	struct mutex_list pi_mutexes;   /* held mutexes which have waiters */
 	int exitcode;                   /* thread's exit code */
 	int refcount;                   /* num threads that will wait for this one */
 	struct thread_queue waitqueue;  /* wait queue for thread lifecycle events */
+	struct threadpool_worker *pool_worker; /* thread pool worker state (null if not a pool worker) */
+	struct workqueue_worker *wq_worker;    /* workqueue worker state (null if not a workqueue worker) */
+	struct work destroy_work;       /* work item which frees the thread after it exits */
+	struct thread_queue *wait_queue; /* queue the thread is waiting in (null if not waiting) */
+	bool timed_out;                 /* set when a timed wait expires */
+	struct fd_table *fd_table;      /* open files (null until the first is opened) */
 	DEFINE_LINK(thread_queue, thread);
 };
 
-extern struct thread *g_current;       /* pointer to current thread */
-extern volatile int g_need_reschedule; /* set to 1 when a new thread should be chosen */
-extern volatile int g_preemption;      /* set to 1 when preemption is enabled */
+/* per-CPU scheduler state: access with percpu_read()/percpu_write() */
+DECLARE_PERCPU(struct thread *, g_current);       /* pointer to current thread */
+DECLARE_PERCPU(volatile int, g_need_reschedule);  /* set to 1 when a new thread should be chosen */
+DECLARE_PERCPU(volatile int, g_preempt_count);    /* preemption is enabled when this is 0 */
+DECLARE_PERCPU(u32_t, g_num_switches);            /* number of context switches */
 
 /* Type of thread start functions */
 typedef void (thread_func_t)(ulong_t arg);
@@ -72,21 +103,60 @@ void thread_init(void);
 
 /* Creating, running, destroying threads. */
 struct thread *thread_create(thread_func_t *start_func, ulong_t arg, thread_mode_t mode);
+struct thread *thread_create_stack(thread_func_t *start_func, ulong_t arg, thread_mode_t mode,
+	size_t stack_size);
 void thread_exit(int exitcode) __attribute__((noreturn));
 int thread_join(struct thread *child);
 
 /* Thread synchronization primitives. */
 void thread_wait(struct thread_queue *queue);
 void thread_park(struct thread_queue *queue);
+bool thread_wait_timeout(struct thread_queue *queue, u32_t ticks);
+bool thread_park_timeout(struct thread_queue *queue, u32_t ticks);
+void thread_sleep(u32_t ticks);
 void thread_wakeup(struct thread_queue *queue);
 void thread_wakeup_one(struct thread_queue *queue);
+struct thread *thread_wakeup_handoff(struct thread_queue *queue);
+struct thread *thread_wakeup_handoff_highest(struct thread_queue *queue);
 void thread_wait_until(struct thread_queue *queue, bool (*pred)(struct thread *), struct thread *thread);
 bool thread_refcount_is_zero(struct thread *thread);
 bool thread_not_running(struct thread *thread);
 void thread_yield(void);
+void thread_yield_to(struct thread *thread);
 void thread_relinquish_cpu(void);
 struct thread *thread_next_runnable(void);
 void thread_make_runnable(struct thread *thread);
+void thread_make_runnable_first(struct thread *thread);
+void thread_set_priority(struct thread *thread, int priority);
+void thread_update_priority(struct thread *thread);
+
+/*
+ * Preemption control.  preempt_disable() calls nest; the current
+ * thread can only be preempted when every one has been matched by
+ * a preempt_enable().  A reschedule requested while preemption was
+ * disabled happens in the outermost preempt_enable().  Each thread
+ * keeps its own count across voluntary context switches.
+ */
+void preempt_schedule(void);
+void preempt_enable_yield_to(struct thread *thread);
+
+#define preemptible() (percpu_read(g_preempt_count) == 0)
+
+static __inline__ void preempt_disable(void)
+{
+	percpu_inc(g_preempt_count);
+	compiler_barrier();
+}
+
+static __inline__ void preempt_enable(void)
+{
+	compiler_barrier();
+	KASSERT(percpu_read(g_preempt_count) > 0);
+	percpu_dec(g_preempt_count);
+	if (percpu_read(g_preempt_count) == 0 && percpu_read(g_need_reschedule) && int_enabled()) {
+		preempt_schedule();
+	}
+}
 
 /* Pick a thread to run and run it, leaving current thread runnable. */
 void thread_schedule(void);
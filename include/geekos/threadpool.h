@@ -0,0 +1,86 @@
+/*
+ * GeekOS - work-stealing kernel thread pool
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef GEEKOS_THREADPOOL_H
+#define GEEKOS_THREADPOOL_H
+
+/*
+ * The thread pool runs CPU-bound kernel jobs (checksumming,
+ * page zeroing, filesystem scans, etc.) in parallel.
+ * A job is split into tasks which are spawned into a task group;
+ * the spawning thread then waits for the group, helping to run
+ * tasks while it waits.  Each pool worker has its own deque of
+ * tasks and steals from randomly chosen peers when it runs out.
+ *
+ * Task and task_group objects are owned by the caller (they are
+ * typically allocated on the stack of the thread that waits for the
+ * group), so spawning a task never allocates memory.
+ *
+ * With a single CPU there are no workers, and spawned tasks are
+ * simply executed inline by the spawning thread.
+ */
+
+#include <geekos/types.h>
+#include <geekos/list.h>
+#include <geekos/thread.h>
+
+struct task;
+struct task_group;
+
+DECLARE_LIST(task_list, task);
+
+/* maximum number of pool worker threads */
+#define THREADPOOL_MAX_WORKERS 16
+
+/*
+ * A unit of work.
+ */
+struct task {
+	void (*func)(void *arg);      /* function to execute */
+	void *arg;                    /* argument passed to func */
+	struct task_group *group;     /* group the task was spawned in */
+	DEFINE_LINK(task_list, task); /* link for the pool's injection queue */
+};
+
+/*
+ * A set of tasks which can be waited for as a whole (fork/join).
+ */
+struct task_group {
+	volatile int pending;          /* number of spawned tasks not yet finished */
+	struct thread_queue waitqueue; /* threads waiting for pending to reach 0 */
+};
+
+/*
+ * Body of a parallel_for loop: processes indices in [start, end).
+ */
+typedef void (parallel_for_func_t)(ulong_t start, ulong_t end, void *arg);
+
+void threadpool_init(void);
+int threadpool_num_workers(void);
+
+void task_init(struct task *task, void (*func)(void *arg), void *arg);
+void task_group_init(struct task_group *group);
+void task_group_spawn(struct task_group *group, struct task *task);
+void task_group_wait(struct task_group *group);
+
+void parallel_for(ulong_t start, ulong_t end, ulong_t grain,
+	parallel_for_func_t *body, void *arg);
+
+#endif /* ifndef GEEKOS_THREADPOOL_H */
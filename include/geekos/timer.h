@@ -22,12 +22,54 @@
 #define GEEKOS_TIMER_H
 
 #include <geekos/types.h>
+#include <geekos/list.h>
+
+/* timer interrupt frequency (override with -DTIMER_HZ=n) */
+#ifndef TIMER_HZ
+#  define TIMER_HZ 1000
+#endif
+
+/* define to stop the periodic tick while the CPU is idle */
+#define TIMER_TICKLESS
+
+/* convert milliseconds to ticks (rounding up) */
+#define TIMER_MS_TO_TICKS(ms) ((u32_t) ((((ms) * TIMER_HZ) + 999) / 1000))
+
+struct timer;
+
+DECLARE_LIST(timer_list, timer);
+
+/*
+ * Kernel timer.
+ * The callback is invoked from the timer softirq,
+ * with interrupts disabled, so it must not block.
+ */
+struct timer {
+	void (*func)(void *data);     /* callback */
+	void *data;                   /* argument passed to callback */
+	u32_t expires;                /* tick at which the timer fires */
+	u32_t period;                 /* reload interval (0 for a one-shot timer) */
+	struct timer_list *bucket;    /* timer wheel bucket (null if not armed) */
+	DEFINE_LINK(timer_list, timer);
+};
 
 /* generic functions */
 void timer_process_tick(void);
+void timer_process_ticks(u32_t ticks);
+void timer_softirq_init(void);
+void timer_idle_enter(void);
+void timer_idle_exit(void);
+void timer_setup(struct timer *timer, void (*func)(void *), void *data);
+void timer_arm(struct timer *timer, u32_t ticks);
+void timer_arm_periodic(struct timer *timer, u32_t period);
+bool timer_cancel(struct timer *timer);
+bool timer_is_armed(struct timer *timer);
 
 /* architecture-dependent functions */
 void timer_init(void);
+u32_t timer_max_oneshot_ticks(void);
+void timer_stop_tick(u32_t ticks);
+u32_t timer_restart_tick(bool expired);
 
 /* global tick counter */
 extern volatile u32_t g_numticks;
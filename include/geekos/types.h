@@ -26,6 +26,8 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+typedef unsigned long long u64_t;
+typedef long long s64_t;
 typedef unsigned long u32_t;
 typedef unsigned short u16_t;
 typedef unsigned char u8_t;
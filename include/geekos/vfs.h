@@ -25,6 +25,7 @@
 #include <stddef.h>
 #include <geekos/list.h>
 #include <geekos/synch.h>
+#include <geekos/rcu.h>
 
 /* maximum length for a path name */
 #define VFS_PATHLEN_MAX 1023
@@ -37,9 +38,11 @@
 struct fs_driver;
 struct fs_instance;
 struct inode;
-struct pagecache;
+struct vm_pagecache;
 
 DECLARE_LIST(inode_list, inode);
+DECLARE_LIST(inode_lru_list, inode);
+DECLARE_LIST(dentry_dir_list, dentry);
 DECLARE_LIST(fs_instance_list, fs_instance);
 
 /*
@@ -90,6 +93,13 @@ struct inode_ops {
 
 	int (*close)(struct inode *inode);
 	int (*lookup)(struct inode *inode, const char *name, struct inode **p_inode); /* dirs only */
+
+	/*
+	 * Record a file's new size on disk after vfs_write() extended it.
+	 * Optional: if null, the new size is only kept in memory, and is
+	 * lost when the inode is evicted.
+	 */
+	int (*write_size)(struct inode *inode, ulong_t size);
 };
 
 typedef enum { VFS_FILE, VFS_DIR } vfs_inode_type_t;
@@ -105,15 +115,39 @@ struct inode {
 	struct inode *parent;         /* parent directory */
 	vfs_inode_type_t type;        /* type: file or directory */
 	char *name;                   /* filename string */
+	u32_t name_hash;              /* hash of name, set by the vfs */
 	struct inode *mount;          /* if another fs_instance is mounted here, ptr to its root directory */
 	struct inode_list child_list; /* list of child files and directories */
 	DEFINE_LINK(inode_list, inode);/* link fields for inode_list */
-	int refcount;                 /* reference count */
-	bool busy;                    /* true if a lookup is in progress */
-	struct condition inode_cond;  /* condition to serialize lookups; must hold fs mutex */
+	int refcount;                 /* reference count (see vfs.c) */
+	bool evicting;                /* being evicted: no new references */
+	DEFINE_LINK(inode_lru_list, inode); /* link fields for unused inode LRU */
+	struct dentry_dir_list dentries; /* dentry cache entries in this directory */
+	struct rcu_head rcu;          /* for freeing after lockless lookups are done */
+	struct mutex lock;            /* serializes lookups which populate child_list */
+	ulong_t size;                 /* file size in bytes */
+	ulong_t disk_size;            /* file size recorded on disk: pages past it have no data there */
+	bool size_dirty;              /* size changed since written back with write_size */
+	struct vm_pagecache *pagecache;/* cached file data (files only) */
 	void *p;                      /* for use by filesystem driver */
 };
 
+/*
+ * Inode cache statistics.
+ */
+struct vfs_inode_cache_stats {
+	int num_inodes;               /* inodes in memory */
+	int num_unused;               /* unreferenced inodes which may be evicted */
+	int max_inodes;               /* inodes kept before unused ones are evicted */
+	int hits;                     /* lookups answered without calling the filesystem */
+	int misses;                   /* lookups which called the filesystem */
+	int evictions;                /* inodes evicted */
+};
+
+void vfs_init(void);
+void vfs_set_inode_cache_max(int max_inodes);
+void vfs_get_inode_cache_stats(struct vfs_inode_cache_stats *stats);
+
 int vfs_mount_root(const char *fs_driver_name, const char *init, const char *opts);
 int vfs_mount(const char *path, const char *fs_driver_name, const char *init, const char *opts);
 
@@ -121,19 +155,21 @@ int vfs_get_root_dir(struct inode **p_dir);
 int vfs_lookup_inode(struct inode *start_dir, const char *path, struct inode **p_inode);
 void vfs_release_ref(struct inode *inode);
 
-int vfs_read(struct inode *inode, void *buf, size_t len);
-int vfs_write(struct inode *inode, void *buf, size_t len);
+int vfs_read(struct inode *inode, void *buf, size_t len, ulong_t offset);
+int vfs_write(struct inode *inode, void *buf, size_t len, ulong_t offset);
 int vfs_close(struct inode *inode);
+void vfs_readahead(struct inode *inode, u32_t page_num, unsigned num_pages);
 
 /*
  * The following functions are called by
  * the fs drivers.
  */
 int vfs_register_fs_driver(struct fs_driver *fs);
+void vfs_add_ref(struct inode *inode);
 int vfs_fs_instance_create(struct fs_instance_ops *ops, void *p, struct fs_instance **p_fs_inst);
 int vfs_inode_create(
 	struct inode_ops *ops, struct fs_instance *fs_inst, struct inode *parent,
-	vfs_inode_type_t type, char *name,
+	vfs_inode_type_t type, char *name, ulong_t size,
 	void *p,
 	struct inode **p_inode);
 
@@ -76,7 +76,11 @@ int vm_pageout(struct vm_pager *pager, u32_t page_num, struct frame *frame);
  * vm_pagecache functions
  */
 int vm_pagecache_create(struct vm_pager *pager, struct vm_pagecache **p_obj);
+void vm_pagecache_destroy(struct vm_pagecache *obj);
 int vm_lock_page(struct vm_pagecache *obj, u32_t page_num, struct frame **p_frame);
+int vm_lock_new_page(struct vm_pagecache *obj, u32_t page_num, struct frame **p_frame);
 int vm_unlock_page(struct vm_pagecache *obj, struct frame *frame);
+void vm_set_page_dirty(struct vm_pagecache *obj, struct frame *frame);
+int vm_pagecache_sync(struct vm_pagecache *obj);
 
 #endif /* GEEKOS_VM_H */
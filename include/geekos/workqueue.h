@@ -26,9 +26,72 @@
  * until a safer point is reached.  For example, it is used
  * to free memory and resources of a thread after the thread
  * is no longer running.
+ *
+ * Callers embed a struct work in their own objects, so queueing
+ * work never allocates memory and may be done with interrupts
+ * disabled.  Each workqueue has a pool of worker threads; when
+ * the worker running an item blocks, another worker is woken
+ * (or created, up to the workqueue's limit) so that the remaining
+ * items are not held up.
+ */
+
+#include <geekos/types.h>
+#include <geekos/list.h>
+#include <geekos/timer.h>
+
+struct work;
+struct workqueue;
+struct workqueue_worker;
+
+DECLARE_LIST(work_list, work);
+
+/* work flags */
+#define WORK_PENDING   (1 << 0)   /* work is queued and has not started */
+#define WORK_HIGHPRI   (1 << 1)   /* work is in the high-priority queue */
+
+/*
+ * A deferred unit of work.
+ * Initialize with work_init(); the object must remain valid
+ * until the callback starts (the callback may free it).
+ */
+struct work {
+	void (*func)(void *data);     /* callback */
+	void *data;                   /* argument passed to callback */
+	struct workqueue *wq;         /* workqueue the work was last queued on */
+	int flags;                    /* WORK_xxx flags */
+	DEFINE_LINK(work_list, work);
+};
+
+/*
+ * Work which is queued after a delay.
  */
+struct delayed_work {
+	struct work work;
+	struct timer timer;           /* fires when the delay expires */
+	struct workqueue *target;     /* workqueue to queue the work on */
+};
+
+/* general-purpose workqueue, used for deferred cleanup */
+extern struct workqueue *g_system_wq;
+/* workqueue for block I/O requests and completions */
+extern struct workqueue *g_io_wq;
 
 void workqueue_init(void);
-void workqueue_schedule_work(void (*callback)(void *), void *data);
+struct workqueue *workqueue_create(const char *name, int max_workers);
+
+void work_init(struct work *work, void (*func)(void *), void *data);
+bool workqueue_queue_work(struct workqueue *wq, struct work *work);
+bool workqueue_queue_work_highpri(struct workqueue *wq, struct work *work);
+void workqueue_schedule_work(struct work *work);
+bool workqueue_cancel_work(struct work *work);
+void delayed_work_init(struct delayed_work *dwork, void (*func)(void *), void *data);
+bool workqueue_queue_delayed_work(struct workqueue *wq, struct delayed_work *dwork, u32_t ticks);
+bool workqueue_cancel_delayed_work(struct delayed_work *dwork);
+bool workqueue_cancel_work_sync(struct work *work);
+void workqueue_flush(struct workqueue *wq);
+
+/* hooks called by the scheduler when a worker thread blocks and resumes */
+void workqueue_worker_sleeping(struct workqueue_worker *worker);
+void workqueue_worker_waking(struct workqueue_worker *worker);
 
 #endif /* ifndef GEEKOS_WORKQUEUE_H */
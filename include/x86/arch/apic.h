@@ -0,0 +1,66 @@
+/*
+ * GeekOS - x86 local APIC and I/O APIC
+ */
+
+#ifndef ARCH_APIC_H
+#define ARCH_APIC_H
+
+#include <geekos/types.h>
+
+/*
+ * The I/O APIC and local APIC register windows both lie in
+ * this 4M region, which is identity-mapped (uncached).
+ */
+#define APIC_MMIO_BASE     0xFEC00000UL
+#define APIC_MMIO_SIZE     0x00400000UL
+
+/* default physical addresses */
+#define IOAPIC_DEFAULT_BASE 0xFEC00000UL
+#define LAPIC_DEFAULT_BASE  0xFEE00000UL
+
+/* IA32_APIC_BASE MSR */
+#define MSR_APIC_BASE         0x1B
+#define MSR_APIC_BASE_ENABLE  (1UL << 11)
+#define MSR_APIC_BASE_ADDR    0xFFFFF000UL
+
+/* local APIC register offsets */
+#define LAPIC_ID        0x020
+#define LAPIC_VERSION   0x030
+#define LAPIC_TPR       0x080   /* task priority */
+#define LAPIC_EOI       0x0B0
+#define LAPIC_SVR       0x0F0   /* spurious interrupt vector */
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_LVT_ERROR 0x370
+#define LAPIC_TIMER_ICR 0x380   /* initial count */
+#define LAPIC_TIMER_CCR 0x390   /* current count */
+#define LAPIC_TIMER_DCR 0x3E0   /* divide configuration */
+
+#define LAPIC_SVR_ENABLE       (1UL << 8)
+#define LAPIC_LVT_MASKED       (1UL << 16)
+#define LAPIC_TIMER_PERIODIC   (1UL << 17)
+#define LAPIC_TIMER_DIV_16     0x3
+
+/* I/O APIC registers (accessed through IOREGSEL/IOWIN) */
+#define IOAPIC_REGSEL   0x00
+#define IOAPIC_WIN      0x10
+#define IOAPIC_REG_VER  0x01
+#define IOAPIC_REG_REDTBL(pin) (0x10 + 2 * (pin))
+
+#define IOAPIC_REDIR_MASKED    (1UL << 16)
+
+/*
+ * Vectors used by the local APIC.
+ */
+#define LAPIC_TIMER_VECTOR    62
+#define LAPIC_SPURIOUS_VECTOR 63
+
+bool apic_init(int first_irq_vector, int num_irqs);
+bool apic_is_enabled(void);
+void apic_set_irq_masked(int irq, bool masked);
+void lapic_eoi(void);
+u32_t lapic_read(u32_t reg);
+void lapic_write(u32_t reg, u32_t value);
+
+#endif /* ifndef ARCH_APIC_H */
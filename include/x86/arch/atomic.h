@@ -0,0 +1,73 @@
+/*
+ * GeekOS - x86 atomic operations
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ */
+
+#ifndef ARCH_ATOMIC_H
+#define ARCH_ATOMIC_H
+
+#include <geekos/types.h>
+
+#ifndef ASM
+
+static __inline__ ulong_t atomic_cmpxchg(volatile ulong_t *p, ulong_t old, ulong_t new)
+{
+	ulong_t prev;
+	__asm__ __volatile__ ("lock; cmpxchgl %2, %1"
+		: "=a" (prev), "+m" (*p)
+		: "r" (new), "0" (old)
+		: "memory");
+	return prev;
+}
+
+static __inline__ ulong_t atomic_xchg(volatile ulong_t *p, ulong_t val)
+{
+	/* xchg with a memory operand is implicitly locked */
+	__asm__ __volatile__ ("xchgl %0, %1"
+		: "+r" (val), "+m" (*p)
+		:
+		: "memory");
+	return val;
+}
+
+static __inline__ int atomic_add_return(volatile int *p, int delta)
+{
+	int old = delta;
+	__asm__ __volatile__ ("lock; xaddl %0, %1"
+		: "+r" (old), "+m" (*p)
+		:
+		: "memory");
+	return old + delta;
+}
+
+static __inline__ void atomic_inc(volatile int *p)
+{
+	__asm__ __volatile__ ("lock; incl %0" : "+m" (*p) : : "memory");
+}
+
+static __inline__ void atomic_dec(volatile int *p)
+{
+	__asm__ __volatile__ ("lock; decl %0" : "+m" (*p) : : "memory");
+}
+
+/*
+ * Full barrier.  A locked add to the top of the stack orders
+ * loads and stores on every x86 CPU, including those without mfence.
+ */
+#define mem_barrier() \
+	__asm__ __volatile__ ("lock; addl $0, (%%esp)" : : : "memory")
+
+#define compiler_barrier() \
+	__asm__ __volatile__ ("" : : : "memory")
+
+/*
+ * x86 does not reorder stores with other stores, or loads with
+ * other loads, so ordering them only requires a compiler barrier.
+ */
+#define write_barrier() compiler_barrier()
+#define read_barrier()  compiler_barrier()
+
+#endif /* ifndef ASM */
+
+#endif /* ifndef ARCH_ATOMIC_H */
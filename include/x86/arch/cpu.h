@@ -178,6 +178,13 @@ struct x86_cpuid_info {
 		unsigned sse4_2 : 1;
 		unsigned reserved4 : 11;
 	} feature_info_ecx;
+
+	/* function 0x80000007: advanced power management info in edx register */
+	struct {
+		unsigned reserved1 : 8;
+		unsigned invariant_tsc : 1;
+		unsigned reserved2 : 23;
+	} apm_info_edx;
 };
 
 /* initialize segment descriptors */
@@ -220,6 +227,27 @@ void x86_set_cr4(u32_t cr4);
 
 /* CPUID */
 bool x86_cpuid(struct x86_cpuid_info *cpuid_info);
+
+/* read/write model-specific registers */
+static __inline__ u64_t x86_rdmsr(u32_t msr)
+{
+	u32_t lo, hi;
+	__asm__ __volatile__ ("rdmsr" : "=a" (lo), "=d" (hi) : "c" (msr));
+	return (((u64_t) hi) << 32) | lo;
+}
+
+static __inline__ void x86_wrmsr(u32_t msr, u64_t value)
+{
+	__asm__ __volatile__ ("wrmsr" : : "c" (msr), "a" ((u32_t) value), "d" ((u32_t) (value >> 32)));
+}
+
+/* read the time stamp counter */
+static __inline__ u64_t x86_rdtsc(void)
+{
+	u32_t lo, hi;
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+	return (((u64_t) hi) << 32) | lo;
+}
 #endif
 
 #define PRIV_KERN 0
@@ -235,6 +263,9 @@ bool x86_cpuid(struct x86_cpuid_info *cpuid_info);
 #define KERN_CS SELECTOR(1, SEL_GDT, 0)
 #define KERN_DS SELECTOR(2, SEL_GDT, 0)
 
+/* selector for the per-CPU data segment (loaded into %fs) */
+#define KERN_PERCPU SELECTOR(4, SEL_GDT, 0)
+
 /*
  * Bits in eflags register.
  */
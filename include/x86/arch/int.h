@@ -7,6 +7,8 @@
 #ifndef ARCH_INT_H
 #define ARCH_INT_H
 
+#include <arch/mem.h>
+
 /*
  * Keep these definitions up-to-date with thread_context struct
  * in arch/thread.h!
@@ -18,4 +20,12 @@
 /* Number of interrupts defined */
 #define INT_NUM_INTERRUPTS 64
 
+/*
+ * Size of the per-CPU interrupt stack.  Interrupt handlers and the
+ * softirqs run on their exit (and any interrupts nested in them) run
+ * on this stack rather than on the kernel stack of the interrupted
+ * thread.
+ */
+#define INT_STACK_SIZE (2 * PAGE_SIZE)
+
 #endif /* ARCH_INT_H */
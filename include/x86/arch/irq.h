@@ -12,4 +12,7 @@
 /* type of IRQ mask bitset */
 typedef u16_t irq_mask_t;
 
+/* number of external IRQs */
+#define IRQ_NUM_IRQS 16
+
 #endif /* ifndef ARCH_IRQ_H */
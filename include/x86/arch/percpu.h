@@ -0,0 +1,60 @@
+/*
+ * GeekOS - x86 per-CPU data access
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ */
+
+#ifndef ARCH_PERCPU_H
+#define ARCH_PERCPU_H
+
+/*
+ * The %fs segment register selects the executing CPU's per-CPU
+ * data segment.  Its base is the offset of the CPU's copy of
+ * the percpu_data section from the link-time copy, so a per-CPU
+ * variable is accessed as %fs:<variable address>.  The boot CPU
+ * uses the link-time copy, so its segment base is 0.  Each CPU
+ * has its own GDT, so the selector value is the same everywhere.
+ *
+ * Assembly code can access per-CPU variables directly, e.g.
+ *   movl %fs:g_current, %eax
+ */
+
+#ifndef ASM
+
+/* Read the executing CPU's copy of a per-CPU variable. */
+#define percpu_read(var) \
+({ \
+	__typeof__(var) percpu_val__; \
+	__asm__ __volatile__ ("mov %%fs:%1, %0" : "=r" (percpu_val__) : "m" (var)); \
+	percpu_val__; \
+})
+
+/* Write the executing CPU's copy of a per-CPU variable. */
+#define percpu_write(var, val) \
+do { \
+	__typeof__(var) percpu_val__ = (val); \
+	__asm__ __volatile__ ("mov %1, %%fs:%0" : "=m" (var) : "r" (percpu_val__)); \
+} while (0)
+
+/* Add to the executing CPU's copy of a 32 bit per-CPU counter. */
+#define percpu_add(var, val) \
+do { \
+	__asm__ __volatile__ ("addl %1, %%fs:%0" : "+m" (var) : "ri" ((u32_t) (val))); \
+} while (0)
+
+#define percpu_inc(var) percpu_add(var, 1)
+#define percpu_dec(var) percpu_add(var, -1)
+
+/*
+ * Get a pointer to the executing CPU's copy of a per-CPU variable.
+ * Only needed when the variable must be passed by reference.
+ */
+#define percpu_ptr(p) \
+	((__typeof__(p)) (((char *) (p)) + percpu_read(g_percpu_offset)))
+
+/* offset of this CPU's per-CPU area from the link-time copy */
+DECLARE_PERCPU(ulong_t, g_percpu_offset);
+
+#endif /* ifndef ASM */
+
+#endif /* ifndef ARCH_PERCPU_H */
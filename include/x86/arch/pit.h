@@ -0,0 +1,37 @@
+/*
+ * GeekOS - x86 8253/8254 programmable interval timer
+ */
+
+#ifndef ARCH_PIT_H
+#define ARCH_PIT_H
+
+/* input clock frequency in Hz */
+#define PIT_FREQ      1193182
+
+/* I/O ports */
+#define PIT_CH0_PORT  0x40
+#define PIT_CH2_PORT  0x42
+#define PIT_CMD_PORT  0x43
+
+/* channel 2 gate and output are controlled through the PC speaker port */
+#define PIT_CH2_GATE_PORT 0x61
+#define PIT_CH2_GATE      0x01     /* gate input of channel 2 */
+#define PIT_SPEAKER_DATA  0x02     /* connect channel 2 output to the speaker */
+#define PIT_CH2_OUT       0x20     /* output of channel 2 */
+
+/* commands */
+#define PIT_CMD_CH0_LATCH    0x00   /* channel 0, latch count */
+#define PIT_CMD_CH0_ONESHOT  0x30   /* channel 0, lo/hi byte, mode 0 */
+#define PIT_CMD_CH0_PERIODIC 0x34   /* channel 0, lo/hi byte, mode 2 */
+#define PIT_CMD_CH2_ONESHOT  0xB0   /* channel 2, lo/hi byte, mode 0 */
+
+#ifndef ASM
+#include <geekos/types.h>
+
+/* channel 2 one-shot delays, for calibrating other timers */
+u8_t pit_ch2_start(u32_t count);
+bool pit_ch2_wait(void);
+void pit_ch2_stop(u8_t gate);
+#endif
+
+#endif /* ifndef ARCH_PIT_H */
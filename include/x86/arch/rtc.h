@@ -0,0 +1,30 @@
+/*
+ * GeekOS - x86 CMOS real-time clock
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ */
+
+#ifndef ARCH_RTC_H
+#define ARCH_RTC_H
+
+#define RTC_IRQ 8
+
+/* I/O ports: select a CMOS register, then read or write it */
+#define RTC_INDEX_PORT   0x70
+#define RTC_DATA_PORT    0x71
+#define RTC_NMI_DISABLE  0x80     /* keep NMIs off while a register is selected */
+
+/* registers */
+#define RTC_REG_A        0x0A
+#define RTC_REG_B        0x0B
+#define RTC_REG_C        0x0C
+
+#define RTC_REGA_RATE_MASK 0x0F   /* periodic rate: 32768 >> (rate - 1) Hz */
+#define RTC_REGB_PIE     0x40     /* periodic interrupt enable */
+#define RTC_REGC_PF      0x40     /* periodic interrupt flag */
+
+#ifndef ASM
+void rtc_init(void);
+#endif
+
+#endif /* ARCH_RTC_H */
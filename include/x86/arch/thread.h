@@ -10,8 +10,16 @@
 #include <arch/mem.h>
 #include <geekos/types.h>
 
-/* kernel thread stack size is one page */
+/*
+ * Default kernel thread stack size is one page.  Since interrupt
+ * handlers, and the softirqs run when they exit, use a separate
+ * interrupt stack, a thread's stack only needs to hold its own
+ * frames plus one thread_context, so threads with shallow call
+ * chains can use much smaller stacks.  (ksoftirqd runs softirqs
+ * on its own stack, which has the default size.)
+ */
 #define THREAD_STACK_SIZE PAGE_SIZE
+#define THREAD_STACK_MIN  1024
 
 /* offset of stack pointer field in thread struct
   (must keep in sync with <geekos/thread.h> */
@@ -53,6 +61,25 @@
 	popl	%ebx ; \
 	popl	%eax
 
+/*
+ * Save and restore the registers a C function must preserve,
+ * for voluntary context switches (see thread_switch_to()).
+ */
+#define THREAD_SAVE_CALLEE_REGISTERS \
+	pushl	%ebp ; \
+	pushl	%ebx ; \
+	pushl	%esi ; \
+	pushl	%edi
+
+#define THREAD_RESTORE_CALLEE_REGISTERS \
+	popl	%edi ; \
+	popl	%esi ; \
+	popl	%ebx ; \
+	popl	%ebp
+
+/* Size of a switch frame: callee-saved registers plus return address */
+#define THREAD_SWITCH_FRAME_SIZE 20
+
 /* Number of bytes occupied by saved registers on the stack */
 #define THREAD_SAVED_REG_LEN 44
 
@@ -53,6 +53,7 @@ struct blockdev_req *blockdev_create_request(lba_t lba, unsigned num_blocks, voi
 	req->state = BLOCKDEV_REQ_PENDING;
 	req->rc = 0;
 	thread_queue_clear(&req->waitqueue);
+	poll_waitqueue_init(&req->poll_waitqueue);
 	req->dev = 0;
 	req->data = 0;
 
@@ -75,6 +76,16 @@ int blockdev_wait_for_completion(struct blockdev_req *req)
 	return req->rc;
 }
 
+/*
+ * Readiness callback for poll sets: POLLIN once the request has finished.
+ */
+unsigned blockdev_req_poll(void *req_, struct poll_table *pt)
+{
+	struct blockdev_req *req = req_;
+	poll_wait(pt, &req->poll_waitqueue);
+	return req->state == BLOCKDEV_REQ_PENDING ? 0 : POLLIN;
+}
+
 int blockdev_post_and_wait(struct blockdev *dev, struct blockdev_req *req)
 {
 	blockdev_post_request(dev, req);
@@ -83,10 +94,22 @@ int blockdev_post_and_wait(struct blockdev *dev, struct blockdev_req *req)
 
 void blockdev_notify_complete(struct blockdev_req *req, int rc)
 {
+	struct thread *waiter;
 	bool iflag = int_begin_atomic();
 	req->state = BLOCKDEV_REQ_FINISHED;
 	req->rc = rc;
+	waiter = thread_wakeup_handoff(&req->waitqueue);
 	thread_wakeup(&req->waitqueue);
+	poll_wakeup(&req->poll_waitqueue, POLLIN);
+
+	/*
+	 * Let the thread waiting for the request run next.  This must
+	 * happen before interrupts are enabled: once it runs, the waiter
+	 * may free the request and exit.
+	 */
+	if (waiter != 0) {
+		thread_yield_to(waiter);
+	}
 	int_end_atomic(iflag);
 }
 
@@ -51,8 +51,8 @@ IMPLEMENT_LIST_NEXT(device_list, device)
 /* linked list of registered devices */
 static struct device_list s_devlist;
 
-/* mutex for accessing the device list */
-static struct mutex s_devlist_mutex;
+/* lock for accessing the device list */
+static struct rwlock s_devlist_lock;
 
 /*
  * Register a device.
@@ -62,7 +62,7 @@ static int dev_register(dev_type_t type, const char *name, void *devobj)
 	int rc = 0;
 	struct device *dev;
 
-	mutex_lock(&s_devlist_mutex);
+	rwlock_write_lock(&s_devlist_lock);
 
 	/* make sure that no device with this name is already registered */
 	for (dev = device_list_get_first(&s_devlist); dev != 0; dev = device_list_next(dev)) {
@@ -83,7 +83,7 @@ static int dev_register(dev_type_t type, const char *name, void *devobj)
 	device_list_append(&s_devlist, dev);
 
 done:
-	mutex_unlock(&s_devlist_mutex);
+	rwlock_write_unlock(&s_devlist_lock);
 
 	return rc;
 }
@@ -151,7 +151,7 @@ void dev_enumerate(dev_callback_t *callback, void *data)
 {
 	struct device *dev;
 
-	mutex_lock(&s_devlist_mutex);
+	rwlock_read_lock(&s_devlist_lock);
 
 	for (dev = device_list_get_first(&s_devlist); dev != 0; dev = device_list_next(dev)) {
 		if (!callback(dev->type, dev->name, dev->devobj, data)) {
@@ -159,5 +159,5 @@ void dev_enumerate(dev_callback_t *callback, void *data)
 		}
 	}
 
-	mutex_unlock(&s_devlist_mutex);
+	rwlock_read_unlock(&s_devlist_lock);
 }
@@ -0,0 +1,314 @@
+/*
+ * GeekOS - open files and file descriptors
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <geekos/file.h>
+#include <geekos/vfs.h>
+#include <geekos/thread.h>
+#include <geekos/mem.h>
+#include <geekos/errno.h>
+#include <geekos/range.h>
+#include <geekos/kassert.h>
+
+/* ---------- Private Implementation ---------- */
+
+/*
+ * Workqueue callback: read the pages requested by the last
+ * vfs_pread() into the page cache.
+ */
+static void vfs_readahead_work(void *file_)
+{
+	struct file *file = file_;
+
+	vfs_readahead(file->inode, file->ra_start, file->ra_count);
+}
+
+/*
+ * Update the readahead state of a file for a read of given
+ * range of pages, and start reading ahead if the file is
+ * being read sequentially.
+ */
+static void vfs_update_readahead(struct file *file, u32_t first_page, u32_t last_page)
+{
+	unsigned window = file->ra_window;
+
+	if (first_page == file->ra_next_page || (window > 0 && first_page + 1 == file->ra_next_page)) {
+		/* sequential: grow the window */
+		window = (window == 0) ? 2 : range_umin(window * 2, VFS_READAHEAD_MAX);
+	} else {
+		window = 0;
+	}
+	file->ra_window = window;
+	file->ra_next_page = last_page + 1;
+
+	if (window > 0) {
+		file->ra_start = last_page + 1;
+		file->ra_count = window;
+		workqueue_queue_work(g_io_wq, &file->ra_work);
+	}
+}
+
+/*
+ * Get the current thread's file descriptor table,
+ * creating it if necessary.
+ */
+static struct fd_table *fd_get_table(void)
+{
+	struct thread *current = percpu_read(g_current);
+	struct fd_table *table = current->fd_table;
+	int fd;
+
+	if (table == 0) {
+		table = mem_alloc(sizeof(struct fd_table));
+		for (fd = 0; fd < FD_TABLE_SIZE; fd++) {
+			table->files[fd] = 0;
+			table->next_free[fd] = (fd + 1 < FD_TABLE_SIZE) ? fd + 1 : -1;
+		}
+		table->free_head = 0;
+		current->fd_table = table;
+	}
+	return table;
+}
+
+/* ---------- Public Interface ---------- */
+
+/*
+ * Open the file or directory named by given absolute path.
+ * Directories may only be opened for reading.
+ * If successful, stores a pointer to the new file object
+ * in *p_file and returns 0.  Otherwise, returns an error code.
+ */
+int vfs_open(const char *path, int mode, struct file **p_file)
+{
+	int rc;
+	struct inode *root_dir = 0, *inode = 0;
+	struct file *file;
+
+	if (*path != '/' || (mode & ~(VFS_OPEN_READ | VFS_OPEN_WRITE)) != 0) {
+		return EINVAL;
+	}
+	while (*path == '/') {
+		path++;
+	}
+
+	rc = vfs_get_root_dir(&root_dir);
+	if (rc != 0) {
+		return rc;
+	}
+
+	if (*path == '\0') {
+		/* the root directory itself */
+		inode = root_dir;
+		root_dir = 0;
+	} else {
+		rc = vfs_lookup_inode(root_dir, path, &inode);
+		if (rc != 0) {
+			goto done;
+		}
+	}
+
+	if (inode->type == VFS_DIR && (mode & VFS_OPEN_WRITE) != 0) {
+		rc = EINVAL;
+		goto done;
+	}
+
+	file = mem_alloc(sizeof(struct file));
+	file->inode = inode;
+	file->mode = mode;
+	mutex_init(&file->pos_lock);
+	file->pos = 0;
+	file->ra_next_page = 0;
+	file->ra_window = 0;
+	work_init(&file->ra_work, &vfs_readahead_work, file);
+
+	/* the file now owns the reference to the inode */
+	inode = 0;
+	*p_file = file;
+
+done:
+	vfs_release_ref(inode);
+	vfs_release_ref(root_dir);
+	return rc;
+}
+
+/*
+ * Close an open file, writing back its modified data and
+ * freeing the file object.
+ * Returns 0 if successful, or an error code if the data could
+ * not be written back.
+ */
+int vfs_file_close(struct file *file)
+{
+	int rc;
+
+	/* readahead must not outlive the file */
+	workqueue_cancel_work_sync(&file->ra_work);
+
+	rc = vfs_close(file->inode);
+	mem_free(file);
+
+	return rc;
+}
+
+/*
+ * Read up to len bytes from given file at given offset,
+ * without using or changing the file position.
+ * Returns the number of bytes read (0 at end of file),
+ * or an error code.
+ */
+int vfs_pread(struct file *file, void *buf, size_t len, ulong_t offset)
+{
+	int rc;
+
+	if ((file->mode & VFS_OPEN_READ) == 0) {
+		return EINVAL;
+	}
+
+	rc = vfs_read(file->inode, buf, len, offset);
+	if (rc > 0) {
+		vfs_update_readahead(file, offset >> PAGE_POWER, (offset + rc - 1) >> PAGE_POWER);
+	}
+	return rc;
+}
+
+/*
+ * Write len bytes to given file at given offset,
+ * without using or changing the file position.
+ * Returns the number of bytes written, or an error code.
+ */
+int vfs_pwrite(struct file *file, void *buf, size_t len, ulong_t offset)
+{
+	if ((file->mode & VFS_OPEN_WRITE) == 0) {
+		return EINVAL;
+	}
+
+	return vfs_write(file->inode, buf, len, offset);
+}
+
+/*
+ * Read from the file position, and advance it.
+ */
+int vfs_file_read(struct file *file, void *buf, size_t len)
+{
+	int rc;
+
+	mutex_lock(&file->pos_lock);
+	rc = vfs_pread(file, buf, len, file->pos);
+	if (rc > 0) {
+		file->pos += rc;
+	}
+	mutex_unlock(&file->pos_lock);
+
+	return rc;
+}
+
+/*
+ * Write at the file position, and advance it.
+ */
+int vfs_file_write(struct file *file, void *buf, size_t len)
+{
+	int rc;
+
+	mutex_lock(&file->pos_lock);
+	rc = vfs_pwrite(file, buf, len, file->pos);
+	if (rc > 0) {
+		file->pos += rc;
+	}
+	mutex_unlock(&file->pos_lock);
+
+	return rc;
+}
+
+/*
+ * Set the file position.
+ */
+void vfs_seek(struct file *file, ulong_t pos)
+{
+	mutex_lock(&file->pos_lock);
+	file->pos = pos;
+	mutex_unlock(&file->pos_lock);
+}
+
+/*
+ * Add an open file to the current thread's descriptor table.
+ * Returns the new file descriptor, or EMFILE if the table is full.
+ */
+int fd_install(struct file *file)
+{
+	struct fd_table *table = fd_get_table();
+	int fd = table->free_head;
+
+	if (fd < 0) {
+		return EMFILE;
+	}
+	table->free_head = table->next_free[fd];
+	table->files[fd] = file;
+
+	return fd;
+}
+
+/*
+ * Get the open file for given descriptor of the current thread.
+ * Returns null if the descriptor is not open.
+ */
+struct file *fd_get(int fd)
+{
+	struct fd_table *table = percpu_read(g_current)->fd_table;
+
+	if (table == 0 || fd < 0 || fd >= FD_TABLE_SIZE) {
+		return 0;
+	}
+	return table->files[fd];
+}
+
+/*
+ * Close given descriptor of the current thread, and the file.
+ * Returns 0 if successful, EBADF if the descriptor is not open,
+ * or the error code from vfs_file_close().
+ */
+int fd_close(int fd)
+{
+	struct fd_table *table = percpu_read(g_current)->fd_table;
+	struct file *file = fd_get(fd);
+
+	if (file == 0) {
+		return EBADF;
+	}
+	table->files[fd] = 0;
+	table->next_free[fd] = table->free_head;
+	table->free_head = fd;
+
+	return vfs_file_close(file);
+}
+
+/*
+ * Close all files in a descriptor table, and free it.
+ * Called when its thread exits.
+ */
+void fd_table_destroy(struct fd_table *table)
+{
+	int fd;
+
+	for (fd = 0; fd < FD_TABLE_SIZE; fd++) {
+		if (table->files[fd] != 0) {
+			vfs_file_close(table->files[fd]);
+		}
+	}
+	mem_free(table);
+}
@@ -0,0 +1,119 @@
+/*
+ * GeekOS - generic IRQ support
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <geekos/irq.h>
+#include <geekos/thread.h>
+#include <geekos/mem.h>
+#include <geekos/errno.h>
+#include <geekos/kassert.h>
+
+/*
+ * An IRQ handled by a dedicated kernel thread.
+ */
+struct irq_thread_desc {
+	int irq;
+	irq_top_half_t *top_half;
+	irq_thread_func_t *thread_func;
+	void *data;
+	bool pending;                  /* set by the top half, cleared by the thread */
+	struct thread *thread;
+	struct thread_queue waitqueue; /* the IRQ thread waits here */
+};
+
+static struct irq_thread_desc *s_irq_threads[IRQ_NUM_IRQS];
+
+/*
+ * Interrupt handler for threaded IRQs: run the top half, and
+ * if it asks for it, mask the IRQ and wake the IRQ thread.
+ */
+static void irq_threaded_handler(struct thread_context *context)
+{
+	int irq = irq_get_number(context);
+	struct irq_thread_desc *desc = s_irq_threads[irq];
+
+	irq_begin(context);
+
+	KASSERT(desc != 0);
+	if (desc->top_half == 0 || desc->top_half(irq, desc->data)) {
+		/* keep the IRQ masked until the thread has handled it */
+		irq_disable(irq);
+		desc->pending = true;
+		thread_wakeup_one(&desc->waitqueue);
+	}
+
+	irq_end(context);
+}
+
+/*
+ * IRQ thread: run the thread function each time the top half fires.
+ */
+static void irq_thread(ulong_t arg)
+{
+	struct irq_thread_desc *desc = (struct irq_thread_desc *) arg;
+
+	int_disable();
+	while (true) {
+		while (!desc->pending) {
+			thread_wait(&desc->waitqueue);
+		}
+		desc->pending = false;
+		int_enable();
+
+		desc->thread_func(desc->irq, desc->data);
+
+		int_disable();
+		irq_enable(desc->irq);
+	}
+}
+
+/*
+ * Install a threaded handler for given IRQ, and enable the IRQ.
+ * top_half may be null, in which case every interrupt wakes
+ * the IRQ thread.  The thread runs at given priority.
+ * Returns 0 if successful, or an error code.
+ */
+int irq_request_threaded(int irq, irq_top_half_t *top_half,
+	irq_thread_func_t *thread_func, void *data, int priority)
+{
+	struct irq_thread_desc *desc;
+
+	if (irq < 0 || irq >= IRQ_NUM_IRQS || thread_func == 0) {
+		return EINVAL;
+	}
+	if (s_irq_threads[irq] != 0) {
+		return EEXIST;
+	}
+
+	desc = mem_alloc(sizeof(struct irq_thread_desc));
+	desc->irq = irq;
+	desc->top_half = top_half;
+	desc->thread_func = thread_func;
+	desc->data = data;
+	thread_queue_clear(&desc->waitqueue);
+	s_irq_threads[irq] = desc;
+
+	desc->thread = thread_create(&irq_thread, (ulong_t) desc, THREAD_DETACHED);
+	thread_set_priority(desc->thread, priority);
+
+	irq_install_handler(irq, &irq_threaded_handler);
+	irq_enable(irq);
+
+	return 0;
+}
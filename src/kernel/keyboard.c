@@ -39,7 +39,8 @@
 #include <geekos/keyboard.h>
 
 /* Wait queue for thread(s) waiting for keyboard events. */
-/* FIXME struct thread_queue s_waitqueue; */
+struct thread_queue s_waitqueue;
+struct poll_waitqueue s_poll_waitqueue;
 u16_t s_queue[QUEUE_SIZE];
 int s_queue_head, s_queue_tail;
 
@@ -85,3 +86,10 @@ u16_t wait_for_key(void)
 
     return keycode;
 }
+
+/* Readiness callback for poll sets: POLLIN when a keycode is available. */
+unsigned keyboard_poll(void *obj, struct poll_table *pt)
+{
+    poll_wait(pt, &s_poll_waitqueue);
+    return is_queue_empty() ? 0 : POLLIN;
+}
@@ -0,0 +1,306 @@
+/*
+ * GeekOS - kernel time and clocksources
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <geekos/ktime.h>
+#include <geekos/timer.h>
+#include <geekos/int.h>
+#include <geekos/cons.h>
+#include <geekos/range.h>
+#include <geekos/kassert.h>
+#include <geekos/synch.h>
+
+/*
+ * NOTES:
+ * - ktime_get() returns base_ns plus the time elapsed on the current
+ *   clocksource since base_cycles was read.  The base is advanced
+ *   periodically, so the cycle delta (and the intermediate product
+ *   in the cycle to ns conversion) stays small, and counters
+ *   narrower than 64 bits are handled by masking the difference.
+ * - The tick counter is always available and serves as the fallback
+ *   clocksource.  A watchdog compares the current clocksource against
+ *   it, and switches back to it if they disagree.
+ * - The clocksource and base are updated with interrupts disabled,
+ *   under s_base_lock; ktime_get() reads them locklessly.
+ */
+
+/* how often to advance the base */
+#define KTIME_UPDATE_MS 100
+
+/* the watchdog runs every KTIME_WATCHDOG_UPDATES base updates */
+#define KTIME_WATCHDOG_UPDATES 5
+
+/*
+ * Maximum disagreement with the tick counter, as a shift
+ * of the watchdog interval (1/8).  This is generous because
+ * stopping the tick while idle can lose partial ticks.
+ */
+#define KTIME_WATCHDOG_SHIFT 3
+
+/* all registered clocksources */
+static struct clocksource *s_clocksource_list;
+
+/* clocksource used by ktime_get() */
+static struct clocksource *s_clock;
+
+/* base for ktime_get() */
+static struct seqlock s_base_lock;
+static u64_t s_base_ns;
+static u64_t s_base_cycles;
+
+/* periodic timer which advances the base and runs the watchdog */
+static struct timer s_update_timer;
+static int s_updates;
+
+/* watchdog state */
+static u64_t s_wd_cycles;
+static u32_t s_wd_ticks;
+
+/* ----------------------------------------------------------------------
+ * Tick counter clocksource
+ * ---------------------------------------------------------------------- */
+
+static u64_t jiffies_read(struct clocksource *cs)
+{
+	return g_numticks;
+}
+
+static struct clocksource s_jiffies_clocksource = {
+	.name = "jiffies",
+	.read = &jiffies_read,
+	.mask = 0xFFFFFFFFULL,
+	.mult = NSEC_PER_SEC / TIMER_HZ,
+	.shift = 0,
+	.rating = 1,
+};
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Return the ns elapsed on given clocksource since given reading.
+ */
+static u64_t clocksource_ns_since(struct clocksource *cs, u64_t last)
+{
+	return clocksource_cyc2ns(cs, (cs->read(cs) - last) & cs->mask);
+}
+
+/*
+ * Start using given clocksource, without letting
+ * ktime_get() jump.  Interrupts must be disabled.
+ */
+static void clocksource_switch(struct clocksource *cs)
+{
+	bool iflag;
+
+	KASSERT(!int_enabled());
+
+	iflag = write_seqlock(&s_base_lock);
+	if (s_clock != 0) {
+		s_base_ns += clocksource_ns_since(s_clock, s_base_cycles);
+	}
+	s_clock = cs;
+	s_base_cycles = cs->read(cs);
+	write_sequnlock(&s_base_lock, iflag);
+
+	s_wd_cycles = s_base_cycles;
+	s_wd_ticks = g_numticks;
+}
+
+/*
+ * Choose the best stable clocksource.
+ * Interrupts must be disabled.
+ */
+static void clocksource_select(void)
+{
+	struct clocksource *cs, *best = &s_jiffies_clocksource;
+
+	KASSERT(!int_enabled());
+
+	for (cs = s_clocksource_list; cs != 0; cs = cs->next) {
+		if (!cs->unstable && cs->rating > best->rating) {
+			best = cs;
+		}
+	}
+
+	if (best != s_clock) {
+		clocksource_switch(best);
+	}
+}
+
+/*
+ * Check the current clocksource against the tick counter.
+ * Called from timer context.
+ */
+static void ktime_watchdog(void)
+{
+	u64_t cs_ns, tick_ns, diff;
+	u32_t ticks = g_numticks;
+
+	if (s_clock == &s_jiffies_clocksource) {
+		return;
+	}
+
+	cs_ns = clocksource_ns_since(s_clock, s_wd_cycles);
+	tick_ns = clocksource_cyc2ns(&s_jiffies_clocksource, (u32_t) (ticks - s_wd_ticks));
+	diff = (cs_ns > tick_ns) ? cs_ns - tick_ns : tick_ns - cs_ns;
+
+	if (diff > (tick_ns >> KTIME_WATCHDOG_SHIFT) + clocksource_cyc2ns(&s_jiffies_clocksource, 1)) {
+		cons_printf("clocksource %s is unstable\n", s_clock->name);
+		clocksource_mark_unstable(s_clock);
+		return;
+	}
+
+	s_wd_cycles = s_clock->read(s_clock);
+	s_wd_ticks = ticks;
+}
+
+/*
+ * Timer callback: advance the base, and periodically run the watchdog.
+ */
+static void ktime_update(void *data)
+{
+	bool iflag;
+
+	KASSERT(!int_enabled());
+
+	iflag = write_seqlock(&s_base_lock);
+	s_base_ns += clocksource_ns_since(s_clock, s_base_cycles);
+	s_base_cycles = s_clock->read(s_clock);
+	write_sequnlock(&s_base_lock, iflag);
+
+	if (++s_updates >= KTIME_WATCHDOG_UPDATES) {
+		s_updates = 0;
+		ktime_watchdog();
+	}
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Initialize kernel time: register and select clocksources.
+ * The timer must already be running.
+ */
+void ktime_init(void)
+{
+	bool iflag;
+
+	cons_printf("Initialize clocksource .........");
+
+	clocksource_register(&s_jiffies_clocksource);
+	clocksource_arch_init();
+
+	iflag = int_begin_atomic();
+	clocksource_select();
+	int_end_atomic(iflag);
+
+	timer_setup(&s_update_timer, &ktime_update, 0);
+	timer_arm_periodic(&s_update_timer, TIMER_MS_TO_TICKS(KTIME_UPDATE_MS));
+
+	cons_printf(".... [%s]\n", s_clock->name);
+}
+
+/*
+ * Get current monotonic time in nanoseconds.
+ */
+ktime_t ktime_get(void)
+{
+	struct clocksource *cs;
+	u64_t ns, cycles;
+	u32_t seq;
+
+	do {
+		seq = read_seqbegin(&s_base_lock);
+		cs = s_clock;
+		ns = s_base_ns;
+		cycles = s_base_cycles;
+	} while (read_seqretry(&s_base_lock, seq));
+
+	if (cs != 0) {
+		ns += clocksource_ns_since(cs, cycles);
+	}
+
+	return (ktime_t) ns;
+}
+
+/*
+ * Compute mult and shift for a clocksource with given frequency.
+ * The largest shift is chosen which keeps mult below 2^24,
+ * so that cycle deltas of up to 2^40 can be converted
+ * without overflow.
+ */
+void clocksource_set_freq_khz(struct clocksource *cs, u32_t khz)
+{
+	int shift;
+	u64_t mult = 0;
+
+	KASSERT(khz > 0);
+
+	for (shift = 32; shift > 0; shift--) {
+		mult = range_div_u64_u32(((u64_t) NSEC_PER_MSEC) << shift, khz);
+		if (mult < (1UL << 24)) {
+			break;
+		}
+	}
+
+	cs->mult = (u32_t) mult;
+	cs->shift = shift;
+}
+
+/*
+ * Register a clocksource.  mult and shift must be set.
+ */
+void clocksource_register(struct clocksource *cs)
+{
+	bool iflag;
+
+	KASSERT(cs->read != 0 && cs->mult != 0);
+
+	iflag = int_begin_atomic();
+	cs->next = s_clocksource_list;
+	s_clocksource_list = cs;
+	if (s_clock != 0) {
+		clocksource_select();
+	}
+	int_end_atomic(iflag);
+}
+
+/*
+ * Mark a clocksource as unstable, so it won't be used.
+ */
+void clocksource_mark_unstable(struct clocksource *cs)
+{
+	bool iflag = int_begin_atomic();
+	cs->unstable = true;
+	if (cs == s_clock) {
+		clocksource_select();
+	}
+	int_end_atomic(iflag);
+}
+
+/*
+ * Get the clocksource currently used by ktime_get().
+ */
+struct clocksource *clocksource_current(void)
+{
+	return s_clock;
+}
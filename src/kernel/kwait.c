@@ -0,0 +1,159 @@
+/*
+ * GeekOS - wait on address
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <geekos/kwait.h>
+#include <geekos/thread.h>
+#include <geekos/list.h>
+#include <geekos/int.h>
+#include <geekos/errno.h>
+#include <geekos/kassert.h>
+
+/*
+ * NOTES:
+ * - Each waiting thread puts a kwait_waiter, on its own stack, in
+ *   the bucket its address hashes to.  Addresses sharing a bucket
+ *   are told apart by the waiter's addr field, so kwake() wakes only
+ *   threads waiting on its own address.
+ * - The buckets are protected by disabling interrupts.
+ */
+
+#define KWAIT_HASH_BITS     6
+#define KWAIT_NUM_BUCKETS   (1 << KWAIT_HASH_BITS)
+
+struct kwait_waiter;
+DECLARE_LIST(kwait_list, kwait_waiter);
+
+struct kwait_waiter {
+	volatile ulong_t *addr;
+	struct thread_queue waitqueue;
+	bool woken;
+	DEFINE_LINK(kwait_list, kwait_waiter);
+};
+
+IMPLEMENT_LIST_APPEND(kwait_list, kwait_waiter)
+IMPLEMENT_LIST_REMOVE(kwait_list, kwait_waiter)
+IMPLEMENT_LIST_GET_FIRST(kwait_list, kwait_waiter)
+IMPLEMENT_LIST_NEXT(kwait_list, kwait_waiter)
+
+static struct kwait_list s_buckets[KWAIT_NUM_BUCKETS];
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+static struct kwait_list *kwait_bucket(volatile ulong_t *addr)
+{
+	/* multiplicative hash; the low two bits of a word address are zero */
+	u32_t hash = (u32_t) (((ulong_t) addr) >> 2) * 0x9e3779b1U;
+	return &s_buckets[hash >> (32 - KWAIT_HASH_BITS)];
+}
+
+/*
+ * Wait on given address, with or without a timeout.
+ */
+static int kwait_common(volatile ulong_t *addr, ulong_t expected, bool timed, u32_t ticks)
+{
+	struct kwait_list *bucket = kwait_bucket(addr);
+	struct kwait_waiter waiter;
+	bool iflag;
+	int rc = 0;
+
+	iflag = int_begin_atomic();
+
+	if (*addr != expected) {
+		int_end_atomic(iflag);
+		return EAGAIN;
+	}
+
+	waiter.addr = addr;
+	waiter.woken = false;
+	thread_queue_clear(&waiter.waitqueue);
+	kwait_list_append(bucket, &waiter);
+
+	if (timed) {
+		thread_wait_timeout(&waiter.waitqueue, ticks);
+	} else {
+		thread_wait(&waiter.waitqueue);
+	}
+
+	if (!waiter.woken) {
+		/* timed out: kwake() did not remove us */
+		kwait_list_remove(bucket, &waiter);
+		rc = ETIMEDOUT;
+	}
+
+	int_end_atomic(iflag);
+	return rc;
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Sleep until woken by kwake() on given address, if the word at
+ * that address still holds the expected value.
+ * Returns 0 when woken, or EAGAIN if the value had changed.
+ * Callers should recheck their condition after waking.
+ */
+int kwait(volatile ulong_t *addr, ulong_t expected)
+{
+	return kwait_common(addr, expected, false, 0);
+}
+
+/*
+ * Like kwait(), but give up after given number of ticks.
+ * Returns 0 when woken, EAGAIN if the value had changed,
+ * or ETIMEDOUT.
+ */
+int kwait_timeout(volatile ulong_t *addr, ulong_t expected, u32_t ticks)
+{
+	return kwait_common(addr, expected, true, ticks);
+}
+
+/*
+ * Wake up at most count threads waiting on given address,
+ * in the order in which they started waiting
+ * (KWAKE_ALL to wake up all of them).
+ * Returns the number of threads woken.
+ */
+int kwake(volatile ulong_t *addr, int count)
+{
+	struct kwait_list *bucket = kwait_bucket(addr);
+	struct kwait_waiter *waiter, *next;
+	int nwoken = 0;
+	bool iflag;
+
+	iflag = int_begin_atomic();
+
+	for (waiter = kwait_list_get_first(bucket); waiter != 0 && nwoken < count; waiter = next) {
+		next = kwait_list_next(waiter);
+		if (waiter->addr != addr) {
+			continue;
+		}
+		kwait_list_remove(bucket, waiter);
+		waiter->woken = true;
+		thread_wakeup(&waiter->waitqueue);
+		nwoken++;
+	}
+
+	int_end_atomic(iflag);
+	return nwoken;
+}
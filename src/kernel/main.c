@@ -27,13 +27,20 @@
 #include <geekos/int.h>
 #include <geekos/irq.h>
 #include <geekos/thread.h>
+#include <geekos/softirq.h>
+#include <geekos/rcu.h>
 #include <geekos/workqueue.h>
+#include <geekos/threadpool.h>
+#include <geekos/vfs.h>
 #include <geekos/timer.h>
+#include <geekos/ktime.h>
 #include <geekos/ramdisk.h>
 #include <geekos/blockdev_pager.h>
 #include <geekos/keyboard.h>
+#include <geekos/range.h>
 
 #include <arch/ata.h>
+#include <arch/rtc.h>
 
 static void test_thread(ulong_t arg)
 {
@@ -41,20 +48,51 @@ static void test_thread(ulong_t arg)
 	thread_exit(42);
 }
 
-static void busy_wait(u32_t ticks)
+/*#define BENCH_YIELD*/
+
+#ifdef BENCH_YIELD
+#define BENCH_YIELD_ROUNDS 100000
+
+static void bench_yield_thread(ulong_t arg)
 {
-	u32_t last = g_numticks;
-	while (g_numticks < last + ticks) {
-		/* wait */
+	int i;
+	for (i = 0; i < BENCH_YIELD_ROUNDS; i++) {
+		thread_yield();
 	}
 }
 
+/*
+ * Measure voluntary context switch latency: two threads
+ * yield to each other while the main thread waits for both.
+ * The switches are counted, rather than assumed to be one per
+ * yield, since creating and joining the threads switches too.
+ */
+static void bench_yield(void)
+{
+	struct thread *a, *b;
+	ktime_t start, elapsed;
+	u32_t switches;
+
+	start = ktime_get();
+	switches = percpu_read(g_num_switches);
+	a = thread_create(&bench_yield_thread, 0, THREAD_ATTACHED);
+	b = thread_create(&bench_yield_thread, 0, THREAD_ATTACHED);
+	thread_join(a);
+	thread_join(b);
+	switches = percpu_read(g_num_switches) - switches;
+	elapsed = ktime_get() - start;
+
+	cons_printf("yield ping-pong: %lu switches, %lu ns per switch\n",
+		(ulong_t) switches, (ulong_t) range_div_u64_u32(elapsed, switches));
+}
+#endif
+
 static void busy_thread(ulong_t arg)
 {
-	busy_wait(90);
+	thread_sleep(TIMER_MS_TO_TICKS(5000));
 	while (1) {
 		cons_printf("A");
-		busy_wait(180);
+		thread_sleep(TIMER_MS_TO_TICKS(10000));
 	}
 }
 
@@ -76,14 +114,20 @@ void geekos_main(u32_t loader_magic, struct multiboot_info *boot_record)
 	vm_init_paging(boot_record);
 	irq_init();
 	thread_init();
+	softirq_init();
+	rcu_init();
 	workqueue_init();
+	threadpool_init();
+	vfs_init();
 	ata_init();
 	timer_init();
+	ktime_init();
 	ramdsk = ramdisk_create(ramdsk_buf, 1024);
 	cons_printf("Created block device pager .....%s\n",
 			blockdev_pager_create(ramdsk, lba_from_num(0), 2, &vmp) ?
 			" [Failed]" : ".... [OK]");
 	keyboard_init();
+	rtc_init();
 
 	/* TODO: spawn init process */
 	{
@@ -96,12 +140,16 @@ void geekos_main(u32_t loader_magic, struct multiboot_info *boot_record)
 		cons_printf("Thread exited with code %d\n", exitcode);
 	}
 
+#ifdef BENCH_YIELD
+	bench_yield();
+#endif
+
 	thread_create(&busy_thread, 0, THREAD_DETACHED);
 
 	/* see if timer is ticking */
-	busy_wait(180);
+	thread_sleep(TIMER_MS_TO_TICKS(10000));
 	cons_printf("wait ...\n");
-	busy_wait(180);
+	thread_sleep(TIMER_MS_TO_TICKS(10000));
 	cons_printf("$ ");
 
 	while (1) {
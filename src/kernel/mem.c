@@ -39,6 +39,10 @@ static struct frame_list s_freelist;
 static struct thread_queue s_heap_waitqueue;
 static struct thread_queue s_frame_waitqueue;
 
+/* registered shrinkers, and how many objects to ask each to free */
+static struct mem_shrinker *s_shrinkers;
+#define MEM_SHRINK_BATCH 8
+
 struct scan_region_data {
 	bool heap_created;
 	unsigned heap_size;
@@ -128,7 +132,9 @@ void *mem_alloc(size_t size)
 
 	iflag = int_begin_atomic();
 	while ((buf = malloc(size)) == 0) {
-		thread_wait(&s_heap_waitqueue);
+		if (mem_shrink(MEM_SHRINK_BATCH) == 0) {
+			thread_wait(&s_heap_waitqueue);
+		}
 	}
 	int_end_atomic(iflag);
 
@@ -176,7 +182,9 @@ struct frame *mem_alloc_frame(frame_state_t initial_state, int initial_refcount)
 	iflag = int_begin_atomic();
 
 	while (frame_list_is_empty(&s_freelist)) {
-		thread_wait(&s_frame_waitqueue);
+		if (mem_shrink(MEM_SHRINK_BATCH) == 0) {
+			thread_wait(&s_frame_waitqueue);
+		}
 	}
 
 	frame = frame_list_remove_first(&s_freelist);
@@ -232,3 +240,33 @@ bool mem_is_page_aligned(ulong_t addr)
 {
 	return mem_round_to_page(addr) == addr;
 }
+
+/*
+ * Register a shrinker, to be called when memory runs low.
+ */
+void mem_register_shrinker(struct mem_shrinker *shrinker)
+{
+	bool iflag = int_begin_atomic();
+	shrinker->next = s_shrinkers;
+	s_shrinkers = shrinker;
+	int_end_atomic(iflag);
+}
+
+/*
+ * Ask registered shrinkers to release cached memory,
+ * stopping once nr_to_free objects have been freed.
+ * Returns the number of objects freed.
+ */
+int mem_shrink(int nr_to_free)
+{
+	struct mem_shrinker *shrinker;
+	int freed = 0;
+	bool iflag = int_begin_atomic();
+
+	for (shrinker = s_shrinkers; shrinker != 0 && freed < nr_to_free; shrinker = shrinker->next) {
+		freed += shrinker->shrink(shrinker, nr_to_free - freed);
+	}
+
+	int_end_atomic(iflag);
+	return freed;
+}
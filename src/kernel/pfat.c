@@ -33,6 +33,9 @@
  * NOTES:
  * - p field of fs_instance object points to pfat_instance object
  * - p field of inode object points to pfat_inode object
+ * - PFAT directory entries do not record file sizes, so there is
+ *   no write_size operation: a file's size is only known while
+ *   its inode is in memory.
  */
 
 #define PFAT_FORMAT_ERROR    EINVAL /* FIXME: better error code? */
@@ -169,7 +172,7 @@ fail:
 
 static int pfat_get_inode(
 	struct fs_instance *fs_inst, u32_t fat_index, struct inode *parent,
-	vfs_inode_type_t type, char *name, struct inode **p_inode)
+	vfs_inode_type_t type, char *name, ulong_t size, struct inode **p_inode)
 {
 	int rc;
 	struct pfat_inode *pfat_inode;
@@ -180,7 +183,7 @@ static int pfat_get_inode(
 	pfat_inode->fat_index = fat_index;
 
 	/* create the actual inode */
-	rc = vfs_inode_create(&s_pfat_inode_ops, fs_inst, parent, type, name, pfat_inode, &inode);
+	rc = vfs_inode_create(&s_pfat_inode_ops, fs_inst, parent, type, name, size, pfat_inode, &inode);
 	if (rc != 0) {
 		goto done;
 	}
@@ -269,14 +272,14 @@ static int pfat_get_root(struct fs_instance *instance, struct inode **p_dir)
 		 * Root directory inode object hasn't been created yet;
 		 * instantiate it.
 		 */
-		rc = pfat_get_inode(instance, inst_data->super->root_dir_fat_index, 0, VFS_DIR, 0, p_dir);
+		rc = pfat_get_inode(instance, inst_data->super->root_dir_fat_index, 0, VFS_DIR, 0, 0, p_dir);
 	} else {
 		/*
 		 * Add a reference to the already-instantiated
 		 * root directory inode.
 		 */
 		*p_dir = inst_data->root_dir;
-		(*p_dir)->refcount++;
+		vfs_add_ref(*p_dir);
 		rc = 0;
 	}
 	KASSERT(rc != 0 || (*p_dir)->refcount > 0);
@@ -314,8 +317,9 @@ static int pfat_write_page(struct inode *inode, void *buf, u32_t page_num)
 
 static int pfat_close(struct inode *inode)
 {
-	KASSERT(false);
-	return ENOTSUP;
+	/* the inode is being evicted: free the PFAT inode data */
+	mem_free(inode->p);
+	return 0;
 }
 
 static int pfat_lookup(struct inode *inode, const char *name, struct inode **p_inode)
@@ -0,0 +1,226 @@
+/*
+ * GeekOS - waiting for multiple events
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <geekos/poll.h>
+#include <geekos/int.h>
+#include <geekos/timer.h>
+#include <geekos/kassert.h>
+
+/*
+ * NOTES:
+ * - Event sources may call poll_wakeup() from interrupt handlers,
+ *   so poll sets and poll wait queues are protected by disabling
+ *   interrupts.
+ * - An item stays registered on its source's wait queue for as long
+ *   as it is in the poll set, so edge-triggered items see events
+ *   which happen while the thread is not waiting.  Its pending events
+ *   start out as the source's readiness when it is added.
+ */
+
+IMPLEMENT_LIST_CLEAR(poll_wq_list, poll_item)
+IMPLEMENT_LIST_APPEND(poll_wq_list, poll_item)
+IMPLEMENT_LIST_REMOVE(poll_wq_list, poll_item)
+IMPLEMENT_LIST_GET_FIRST(poll_wq_list, poll_item)
+IMPLEMENT_LIST_NEXT(poll_wq_list, poll_item)
+
+IMPLEMENT_LIST_CLEAR(poll_set_list, poll_item)
+IMPLEMENT_LIST_APPEND(poll_set_list, poll_item)
+IMPLEMENT_LIST_REMOVE(poll_set_list, poll_item)
+IMPLEMENT_LIST_GET_FIRST(poll_set_list, poll_item)
+IMPLEMENT_LIST_NEXT(poll_set_list, poll_item)
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Determine which of an item's requested events to report.
+ * Interrupts must be disabled.
+ */
+static unsigned poll_item_check(struct poll_item *item)
+{
+	unsigned wanted = item->events & ~POLLET;
+	unsigned revents;
+
+	KASSERT(!int_enabled());
+
+	if ((item->events & POLLET) != 0) {
+		revents = item->pending & wanted;
+		item->pending &= ~revents;
+	} else {
+		revents = item->poll(item->obj, 0) & wanted;
+		item->pending = 0;
+	}
+	return revents;
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Initialize an event source's poll wait queue.
+ */
+void poll_waitqueue_init(struct poll_waitqueue *pwq)
+{
+	poll_wq_list_clear(&pwq->items);
+}
+
+/*
+ * Called by a readiness callback to register the item being added
+ * to a poll set on given wait queue.  Does nothing if pt is null
+ * (the callback is only being asked for the current readiness).
+ */
+void poll_wait(struct poll_table *pt, struct poll_waitqueue *pwq)
+{
+	struct poll_item *item;
+
+	KASSERT(!int_enabled());
+
+	if (pt == 0) {
+		return;
+	}
+
+	item = pt->item;
+	KASSERT(item->pwq == 0);
+	item->pwq = pwq;
+	poll_wq_list_append(&pwq->items, item);
+}
+
+/*
+ * Called by an event source when events occur: wake the threads
+ * waiting on poll sets which contain the source.
+ */
+void poll_wakeup(struct poll_waitqueue *pwq, unsigned events)
+{
+	struct poll_item *item;
+	bool iflag = int_begin_atomic();
+
+	for (item = poll_wq_list_get_first(&pwq->items); item != 0; item = poll_wq_list_next(item)) {
+		item->pending |= events;
+		if ((events & item->events) != 0) {
+			thread_wakeup(&item->set->waitqueue);
+		}
+	}
+
+	int_end_atomic(iflag);
+}
+
+/*
+ * Initialize a poll item for given event source.
+ */
+void poll_item_init(struct poll_item *item, poll_func_t *poll, void *obj, unsigned events)
+{
+	item->poll = poll;
+	item->obj = obj;
+	item->events = events;
+	item->revents = 0;
+	item->pending = 0;
+	item->set = 0;
+	item->pwq = 0;
+}
+
+/*
+ * Initialize a poll set.
+ */
+void poll_set_init(struct poll_set *set)
+{
+	poll_set_list_clear(&set->items);
+	thread_queue_clear(&set->waitqueue);
+}
+
+/*
+ * Add an item to a poll set, registering it with its event source.
+ * Readiness at the time the item is added counts as an event, so
+ * an edge-triggered item reports an event source which was already
+ * ready.
+ */
+void poll_set_add(struct poll_set *set, struct poll_item *item)
+{
+	struct poll_table pt;
+	bool iflag;
+
+	KASSERT(item->set == 0);
+
+	iflag = int_begin_atomic();
+	item->set = set;
+	poll_set_list_append(&set->items, item);
+	pt.item = item;
+	item->pending = item->poll(item->obj, &pt);
+	int_end_atomic(iflag);
+}
+
+/*
+ * Remove an item from a poll set.
+ */
+void poll_set_remove(struct poll_set *set, struct poll_item *item)
+{
+	bool iflag;
+
+	KASSERT(item->set == set);
+
+	iflag = int_begin_atomic();
+	if (item->pwq != 0) {
+		poll_wq_list_remove(&item->pwq->items, item);
+		item->pwq = 0;
+	}
+	poll_set_list_remove(&set->items, item);
+	item->set = 0;
+	int_end_atomic(iflag);
+}
+
+/*
+ * Wait until at least one item in the poll set is ready, or until
+ * given number of ticks has passed (POLL_INFINITE to wait forever,
+ * 0 to just check).  Sets revents in every item.
+ * Returns the number of ready items (0 on timeout).
+ */
+int poll_set_wait(struct poll_set *set, u32_t ticks)
+{
+	struct poll_item *item;
+	int nready;
+	bool timed_out = false;
+	u32_t deadline = g_numticks + ticks;
+	bool iflag = int_begin_atomic();
+
+	while (true) {
+		nready = 0;
+		for (item = poll_set_list_get_first(&set->items); item != 0; item = poll_set_list_next(item)) {
+			item->revents = poll_item_check(item);
+			if (item->revents != 0) {
+				nready++;
+			}
+		}
+
+		if (nready > 0 || ticks == 0 || timed_out) {
+			break;
+		}
+
+		if (ticks == POLL_INFINITE) {
+			thread_wait(&set->waitqueue);
+		} else {
+			long left = (long) (deadline - g_numticks);
+			timed_out = left <= 0 || !thread_wait_timeout(&set->waitqueue, (u32_t) left);
+		}
+	}
+
+	int_end_atomic(iflag);
+	return nready;
+}
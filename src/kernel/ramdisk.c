@@ -81,8 +81,9 @@ done:
 
 void ramdisk_post_request(struct blockdev *dev, struct blockdev_req *req)
 {
-	/* schedule the request for later handling by the workqueue thread */
-	workqueue_schedule_work(&ramdisk_handle_request, req);
+	/* schedule the request for later handling by an I/O worker */
+	work_init(&req->work, &ramdisk_handle_request, req);
+	workqueue_queue_work(g_io_wq, &req->work);
 }
 
 ulong_t ramdisk_get_num_blocks(struct blockdev *dev)
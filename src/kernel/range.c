@@ -18,6 +18,7 @@
  */
 
 #include <geekos/range.h>
+#include <geekos/kassert.h>
 
 /*
  * Return the minimum of two unsigned values.
@@ -78,3 +79,27 @@ bool range_is_power_of_two(unsigned val)
 {
 	return range_bit_count(val) == 1;
 }
+
+/*
+ * Divide a 64-bit value by a 32-bit value.
+ * (The kernel is not linked against libgcc, so the compiler's
+ * 64-bit division helpers are not available.)
+ */
+u64_t range_div_u64_u32(u64_t dividend, u32_t divisor)
+{
+	u64_t quotient = 0, rem = 0;
+	int i;
+
+	KASSERT(divisor != 0);
+
+	/* simple shift-and-subtract long division */
+	for (i = 63; i >= 0; i--) {
+		rem = (rem << 1) | ((dividend >> i) & 1);
+		if (rem >= divisor) {
+			rem -= divisor;
+			quotient |= (1ULL << i);
+		}
+	}
+
+	return quotient;
+}
@@ -0,0 +1,212 @@
+/*
+ * GeekOS - read-copy-update (RCU)
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <geekos/rcu.h>
+#include <geekos/softirq.h>
+#include <geekos/thread.h>
+#include <geekos/int.h>
+#include <geekos/percpu.h>
+#include <geekos/kassert.h>
+
+/*
+ * NOTES:
+ * - Callbacks pass through three lists: s_next_list (waiting for
+ *   a grace period to start), s_wait_list (waiting for the current
+ *   grace period to end), and s_done_list (ready to be invoked).
+ * - A grace period ends when each of the g_num_cpus CPUs has
+ *   reported a quiescent state since it started.  Each CPU
+ *   remembers the last grace period it reported for, so it
+ *   is counted only once.
+ * - Callbacks are invoked from SOFTIRQ_RCU, which also starts
+ *   the next grace period if more callbacks are waiting.
+ * - All of the state is protected by disabling interrupts.
+ */
+
+struct rcu_list {
+	struct rcu_head *head;
+	struct rcu_head **tail;
+};
+
+static struct rcu_list s_next_list;
+static struct rcu_list s_wait_list;
+static struct rcu_list s_done_list;
+
+/* number of the current (or most recent) grace period */
+static u32_t s_gp_seq;
+static bool s_gp_active;
+/* CPUs which have not yet passed a quiescent state in this grace period */
+static int s_gp_cpus_left;
+
+/* last grace period for which this CPU reported a quiescent state */
+DEFINE_PERCPU(u32_t, g_rcu_qs_seq);
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+static void rcu_list_init(struct rcu_list *list)
+{
+	list->head = 0;
+	list->tail = &list->head;
+}
+
+/*
+ * Move all callbacks from one list to the end of another.
+ */
+static void rcu_list_splice(struct rcu_list *to, struct rcu_list *from)
+{
+	if (from->head != 0) {
+		*to->tail = from->head;
+		to->tail = from->tail;
+		rcu_list_init(from);
+	}
+}
+
+/*
+ * Start a grace period for the callbacks queued so far,
+ * unless one is already in progress.
+ * Interrupts must be disabled.
+ */
+static void rcu_start_gp(void)
+{
+	KASSERT(!int_enabled());
+
+	if (s_gp_active || s_next_list.head == 0) {
+		return;
+	}
+
+	rcu_list_splice(&s_wait_list, &s_next_list);
+	s_gp_seq++;
+	s_gp_active = true;
+	s_gp_cpus_left = g_num_cpus;
+}
+
+/*
+ * Softirq action: invoke callbacks whose grace period has ended,
+ * and start the next grace period.
+ */
+static void rcu_softirq_action(void)
+{
+	struct rcu_head *head, *next;
+
+	int_disable();
+	head = s_done_list.head;
+	rcu_list_init(&s_done_list);
+	rcu_start_gp();
+	int_enable();
+
+	for (; head != 0; head = next) {
+		next = head->next;
+		head->func(head);
+	}
+}
+
+/* state used by synchronize_rcu() */
+struct rcu_synchronize {
+	struct rcu_head head;
+	bool done;
+	struct thread_queue waitqueue;
+};
+
+static void rcu_synchronize_callback(struct rcu_head *head)
+{
+	struct rcu_synchronize *rs = (struct rcu_synchronize *) head;
+	bool iflag = int_begin_atomic();
+	rs->done = true;
+	thread_wakeup(&rs->waitqueue);
+	int_end_atomic(iflag);
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Initialize RCU.
+ */
+void rcu_init(void)
+{
+	rcu_list_init(&s_next_list);
+	rcu_list_init(&s_wait_list);
+	rcu_list_init(&s_done_list);
+	softirq_register(SOFTIRQ_RCU, &rcu_softirq_action);
+}
+
+/*
+ * Arrange for func to be called with given rcu_head after
+ * a grace period, when no reader can still see the object
+ * containing it.  The callback runs in softirq context.
+ */
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head))
+{
+	bool iflag;
+
+	head->func = func;
+	head->next = 0;
+
+	iflag = int_begin_atomic();
+	*s_next_list.tail = head;
+	s_next_list.tail = &head->next;
+	rcu_start_gp();
+	int_end_atomic(iflag);
+}
+
+/*
+ * Wait until all read-side critical sections which began
+ * before the call have finished.
+ */
+void synchronize_rcu(void)
+{
+	struct rcu_synchronize rs;
+	bool iflag;
+
+	KASSERT(preemptible());
+
+	rs.done = false;
+	thread_queue_clear(&rs.waitqueue);
+	call_rcu(&rs.head, &rcu_synchronize_callback);
+
+	iflag = int_begin_atomic();
+	while (!rs.done) {
+		thread_wait(&rs.waitqueue);
+	}
+	int_end_atomic(iflag);
+}
+
+/*
+ * Report that this CPU is in a quiescent state: it is not in
+ * a read-side critical section.  Interrupts must be disabled.
+ */
+void rcu_note_quiescent_state(void)
+{
+	KASSERT(!int_enabled());
+
+	if (!s_gp_active || percpu_read(g_rcu_qs_seq) == s_gp_seq) {
+		return;
+	}
+
+	percpu_write(g_rcu_qs_seq, s_gp_seq);
+	if (--s_gp_cpus_left == 0) {
+		/* grace period over: its callbacks can run */
+		s_gp_active = false;
+		rcu_list_splice(&s_done_list, &s_wait_list);
+		softirq_raise(SOFTIRQ_RCU);
+	}
+}
@@ -0,0 +1,295 @@
+/*
+ * GeekOS - softirqs and tasklets
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <geekos/softirq.h>
+#include <geekos/thread.h>
+#include <geekos/int.h>
+#include <geekos/kassert.h>
+
+/*
+ * NOTES:
+ * - Softirqs are run by softirq_irq_exit(), which the low-level
+ *   interrupt code calls after every handler.  They only run
+ *   when returning from the outermost handler, and never
+ *   recursively: interrupts which arrive while softirqs are
+ *   running just raise more softirqs.
+ * - Softirqs run on exit from an interrupt use the interrupt
+ *   stack.  Preemption is disabled while softirqs run, so that
+ *   the exit from an interrupt nested in them never switches
+ *   threads with softirq frames left on that stack.
+ * - The tasklet lists are conceptually per-CPU; since only
+ *   the boot CPU takes interrupts, they are simply global.
+ */
+
+/* passes through the pending mask before deferring to ksoftirqd */
+#define SOFTIRQ_MAX_RESTART 10
+
+struct tasklet_list {
+	struct tasklet *head;
+	struct tasklet **tail;
+};
+
+DEFINE_PERCPU(u32_t, g_softirq_pending);
+DEFINE_PERCPU(int, g_in_softirq);
+
+static softirq_action_t *s_softirq_vec[SOFTIRQ_NUM];
+
+static struct tasklet_list s_tasklet_list;
+static struct tasklet_list s_tasklet_hi_list;
+
+/* the ksoftirqd thread waits here for excess softirq work */
+static struct thread_queue s_ksoftirqd_waitqueue;
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+static void softirq_wakeup_ksoftirqd(void)
+{
+	KASSERT(!int_enabled());
+	thread_wakeup_one(&s_ksoftirqd_waitqueue);
+}
+
+/*
+ * Run pending softirqs.
+ * Called with interrupts disabled; they are enabled while
+ * each batch of softirq actions runs.
+ */
+static void softirq_run(void)
+{
+	int restart = SOFTIRQ_MAX_RESTART;
+	u32_t pending;
+
+	KASSERT(!int_enabled());
+	KASSERT(!percpu_read(g_in_softirq));
+
+	preempt_disable();
+	percpu_write(g_in_softirq, 1);
+
+	while ((pending = percpu_read(g_softirq_pending)) != 0) {
+		int nr;
+
+		if (restart-- == 0) {
+			/* let ksoftirqd handle the rest */
+			softirq_wakeup_ksoftirqd();
+			break;
+		}
+
+		percpu_write(g_softirq_pending, 0);
+		int_enable();
+
+		for (nr = 0; pending != 0; nr++, pending >>= 1) {
+			if ((pending & 1) != 0 && s_softirq_vec[nr] != 0) {
+				s_softirq_vec[nr]();
+			}
+		}
+
+		int_disable();
+	}
+
+	percpu_write(g_in_softirq, 0);
+	preempt_enable();
+}
+
+/*
+ * Thread which runs softirqs when they are raised outside
+ * interrupt context, or faster than interrupt exits can handle.
+ */
+static void ksoftirqd_thread(ulong_t arg)
+{
+	int_disable();
+	while (true) {
+		while (percpu_read(g_softirq_pending) == 0) {
+			thread_wait(&s_ksoftirqd_waitqueue);
+		}
+		softirq_run();
+
+		/* give other threads a chance to run */
+		int_enable();
+		thread_yield();
+		int_disable();
+	}
+}
+
+static void tasklet_list_init(struct tasklet_list *list)
+{
+	list->head = 0;
+	list->tail = &list->head;
+}
+
+static void tasklet_enqueue(struct tasklet_list *list, struct tasklet *tasklet, int nr)
+{
+	bool iflag = int_begin_atomic();
+
+	if (!(tasklet->state & TASKLET_SCHEDULED)) {
+		tasklet->state |= TASKLET_SCHEDULED;
+		tasklet->next = 0;
+		*list->tail = tasklet;
+		list->tail = &tasklet->next;
+		softirq_raise(nr);
+	}
+
+	int_end_atomic(iflag);
+}
+
+/*
+ * Run the tasklets in given list.  Called from a softirq action,
+ * with interrupts enabled.
+ */
+static void tasklet_run_list(struct tasklet_list *list, int nr)
+{
+	struct tasklet *tasklet, *next;
+
+	/* take the whole list */
+	int_disable();
+	tasklet = list->head;
+	tasklet_list_init(list);
+	int_enable();
+
+	for (; tasklet != 0; tasklet = next) {
+		next = tasklet->next;
+
+		int_disable();
+		if (tasklet->state & TASKLET_RUNNING) {
+			/* running on another CPU: try again later */
+			tasklet->state &= ~TASKLET_SCHEDULED;
+			int_enable();
+			tasklet_enqueue(list, tasklet, nr);
+			continue;
+		}
+		tasklet->state = (tasklet->state & ~TASKLET_SCHEDULED) | TASKLET_RUNNING;
+		int_enable();
+
+		tasklet->func(tasklet->data);
+
+		int_disable();
+		tasklet->state &= ~TASKLET_RUNNING;
+		int_enable();
+	}
+}
+
+static void tasklet_action(void)
+{
+	tasklet_run_list(&s_tasklet_list, SOFTIRQ_TASKLET);
+}
+
+static void tasklet_hi_action(void)
+{
+	tasklet_run_list(&s_tasklet_hi_list, SOFTIRQ_HI);
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Initialize softirqs and tasklets, and start ksoftirqd.
+ */
+void softirq_init(void)
+{
+	struct thread *ksoftirqd;
+
+	tasklet_list_init(&s_tasklet_list);
+	tasklet_list_init(&s_tasklet_hi_list);
+	thread_queue_clear(&s_ksoftirqd_waitqueue);
+
+	softirq_register(SOFTIRQ_HI, &tasklet_hi_action);
+	softirq_register(SOFTIRQ_TASKLET, &tasklet_action);
+
+	ksoftirqd = thread_create(&ksoftirqd_thread, 0UL, THREAD_DETACHED);
+	thread_set_priority(ksoftirqd, THREAD_PRIO_HIGH);
+}
+
+/*
+ * Register the action for given softirq.
+ */
+void softirq_register(int nr, softirq_action_t *action)
+{
+	KASSERT(nr >= 0 && nr < SOFTIRQ_NUM);
+	s_softirq_vec[nr] = action;
+}
+
+/*
+ * Raise given softirq.  In interrupt context, it runs on
+ * exit from the outermost handler; otherwise ksoftirqd runs it.
+ */
+void softirq_raise(int nr)
+{
+	bool iflag = int_begin_atomic();
+
+	KASSERT(nr >= 0 && nr < SOFTIRQ_NUM);
+	percpu_write(g_softirq_pending, percpu_read(g_softirq_pending) | (1UL << nr));
+
+	if (!softirq_in_interrupt()) {
+		softirq_wakeup_ksoftirqd();
+	}
+
+	int_end_atomic(iflag);
+}
+
+/*
+ * Called by the low-level interrupt code after each handler
+ * returns, with interrupts disabled.
+ */
+void softirq_irq_exit(void)
+{
+	KASSERT(!int_enabled());
+
+	if (percpu_read(g_int_nesting) == 0 &&
+	    percpu_read(g_softirq_pending) != 0 &&
+	    !percpu_read(g_in_softirq)) {
+		softirq_run();
+	}
+}
+
+/*
+ * Return true if running in an interrupt handler or softirq.
+ */
+bool softirq_in_interrupt(void)
+{
+	return percpu_read(g_int_nesting) > 0 || percpu_read(g_in_softirq);
+}
+
+/*
+ * Initialize a tasklet.
+ */
+void tasklet_init(struct tasklet *tasklet, void (*func)(ulong_t), ulong_t data)
+{
+	tasklet->func = func;
+	tasklet->data = data;
+	tasklet->state = 0;
+	tasklet->next = 0;
+}
+
+/*
+ * Schedule a tasklet to run (once) from the normal tasklet softirq.
+ */
+void tasklet_schedule(struct tasklet *tasklet)
+{
+	tasklet_enqueue(&s_tasklet_list, tasklet, SOFTIRQ_TASKLET);
+}
+
+/*
+ * Schedule a tasklet to run (once) from the high-priority tasklet softirq.
+ */
+void tasklet_hi_schedule(struct tasklet *tasklet)
+{
+	tasklet_enqueue(&s_tasklet_hi_list, tasklet, SOFTIRQ_HI);
+}
@@ -21,6 +21,8 @@
 #include <geekos/synch.h>
 #include <geekos/int.h>
 #include <geekos/kassert.h>
+#include <geekos/errno.h>
+#include <geekos/atomic.h>
 
 /*
  * NOTES:
@@ -32,58 +34,221 @@
  *   with interrupts enabled.
  */
 
+/* maximum length of a chain of blocked owners to boost */
+#define MUTEX_PI_MAX_DEPTH 8
+
+IMPLEMENT_LIST_APPEND(mutex_list, mutex)
+IMPLEMENT_LIST_REMOVE(mutex_list, mutex)
+IMPLEMENT_LIST_GET_FIRST(mutex_list, mutex)
+IMPLEMENT_LIST_NEXT(mutex_list, mutex)
+
 /* ----------------------------------------------------------------------
  * Private functions
  * ---------------------------------------------------------------------- */
 
+/*
+ * Return the highest priority of the threads waiting for given mutex.
+ */
+static int mutex_top_waiter_priority(struct mutex *mutex)
+{
+	struct thread *thread;
+	int priority = THREAD_PRIO_MIN;
+
+	for (thread = thread_queue_get_first(&mutex->waitqueue);
+	     thread != 0;
+	     thread = thread_queue_next(thread)) {
+		if (thread->priority > priority) {
+			priority = thread->priority;
+		}
+	}
+	return priority;
+}
+
+/*
+ * Raise the owner of given mutex to at least given priority,
+ * following the chain of owners which are themselves blocked
+ * on mutexes.  Preemption must be disabled.
+ */
+static void mutex_pi_boost(struct mutex *mutex, int priority)
+{
+	int depth;
+
+	for (depth = 0; mutex != 0 && depth < MUTEX_PI_MAX_DEPTH; depth++) {
+		struct thread *owner = MUTEX_OWNER(mutex->owner);
+
+		if (owner == 0 || owner->pi_priority >= priority) {
+			break;
+		}
+		owner->pi_priority = priority;
+		thread_update_priority(owner);
+
+		mutex = owner->blocked_on;
+	}
+}
+
+/*
+ * Recompute the inherited priority of given thread from
+ * the waiters of the mutexes it still holds.
+ * Preemption must be disabled.
+ */
+static void mutex_pi_restore(struct thread *thread)
+{
+	struct mutex *mutex;
+	int priority = THREAD_PRIO_MIN;
+
+	for (mutex = mutex_list_get_first(&thread->pi_mutexes);
+	     mutex != 0;
+	     mutex = mutex_list_next(mutex)) {
+		int top = mutex_top_waiter_priority(mutex);
+		if (top > priority) {
+			priority = top;
+		}
+	}
+	thread->pi_priority = priority;
+	thread_update_priority(thread);
+}
+
 /*
  * Lock given mutex.
  * Preemption must be disabled.
  */
-static __inline__ void mutex_lock_imp(struct mutex *mutex)
+static void mutex_lock_imp(struct mutex *mutex)
 {
-	KASSERT(!g_preemption);
+	struct thread *current = percpu_read(g_current);
+	ulong_t owner;
+
+	KASSERT(!preemptible());
 
 	/* Make sure we're not already holding the mutex */
 	KASSERT(!MUTEX_IS_HELD(mutex));
 
-	/* wait until the mutex is in an unlocked state */
-	while (mutex->state == MUTEX_LOCKED) {
+	while (true) {
+		owner = mutex->owner;
+
+		if (owner == 0) {
+			/* unlocked: try to take it */
+			if (atomic_cmpxchg(&mutex->owner, 0, (ulong_t) current) == 0) {
+				break;
+			}
+			continue;
+		}
+
+		if (MUTEX_OWNER(owner) == current) {
+			/* the previous owner handed it to us */
+			break;
+		}
+
+		/*
+		 * Make sure the owner takes the slow path on unlock,
+		 * then wait.  Since preemption is disabled, the owner
+		 * cannot run before we are in the wait queue.
+		 */
+		if ((owner & MUTEX_WAITERS) == 0 &&
+		    atomic_cmpxchg(&mutex->owner, owner, owner | MUTEX_WAITERS) != owner) {
+			continue;
+		}
+
+		/* lend our priority to the owner while we wait */
+		if (!mutex->pi_linked) {
+			mutex_list_append(&MUTEX_OWNER(owner)->pi_mutexes, mutex);
+			mutex->pi_linked = true;
+		}
+		current->blocked_on = mutex;
+		mutex_pi_boost(mutex, current->priority);
+
 		thread_park(&mutex->waitqueue);
 	}
+	current->blocked_on = 0;
 
 	/* Now it's ours! */
-	mutex->state = MUTEX_LOCKED;
-	mutex->owner = g_current;
+	KASSERT(MUTEX_IS_HELD(mutex));
 }
 
 /*
  * Unlock given mutex.
  * Preemption must be disabled.
+ * Returns the thread the mutex was handed to, or 0 if
+ * there were no waiters.
  */
-static __inline__ void mutex_unlock_imp(struct mutex *mutex)
+static struct thread *mutex_unlock_imp(struct mutex *mutex)
 {
-	KASSERT(!g_preemption);
+	struct thread *waiter = 0;
+	ulong_t owner;
+
+	KASSERT(!preemptible());
 
 	/* Make sure mutex was actually acquired by this thread. */
 	KASSERT(MUTEX_IS_HELD(mutex));
 
-	/* unlock the mutex. */
-	mutex->state = MUTEX_UNLOCKED;
-	mutex->owner = 0;
-
 	/*
-	 * If there are threads waiting to acquire the mutex,
-	 * wake one of them up.  Note that it is legal to inspect
-	 * the queue with interrupts enabled because preemption
-	 * is disabled, and therefore we know that no thread can
-	 * concurrently add itself to the queue.
+	 * If there are threads waiting to acquire the mutex, hand
+	 * it directly to the first one, so that it cannot be stolen
+	 * before the waiter gets to run.  Otherwise unlock it.
+	 * Note that it is legal to inspect the queue with interrupts
+	 * enabled because preemption is disabled, and therefore we
+	 * know that no thread can concurrently add itself to the queue.
 	 */
 	if (!thread_queue_is_empty(&mutex->waitqueue)) {
+		struct thread *current = percpu_read(g_current);
+
+		/* the mutex no longer contributes to our priority */
+		if (mutex->pi_linked) {
+			mutex_list_remove(&current->pi_mutexes, mutex);
+			mutex->pi_linked = false;
+		}
+
+		/* hand the mutex to the most important waiter */
 		int_disable();
-		thread_wakeup_one(&mutex->waitqueue);
+		waiter = thread_wakeup_handoff_highest(&mutex->waitqueue);
+		owner = (ulong_t) waiter;
+		if (!thread_queue_is_empty(&mutex->waitqueue)) {
+			owner |= MUTEX_WAITERS;
+		}
+		atomic_xchg(&mutex->owner, owner);
 		int_enable();
+
+		/* remaining waiters now boost the new owner */
+		if (!thread_queue_is_empty(&mutex->waitqueue)) {
+			mutex_list_append(&waiter->pi_mutexes, mutex);
+			mutex->pi_linked = true;
+			mutex_pi_boost(mutex, mutex_top_waiter_priority(mutex));
+		}
+
+		/* drop any priority inherited through this mutex */
+		mutex_pi_restore(current);
+	} else {
+		atomic_xchg(&mutex->owner, 0);
 	}
+
+	return waiter;
+}
+
+/*
+ * Slow path of mutex_lock(): the mutex is held by another thread.
+ */
+static void mutex_lock_slow(struct mutex *mutex)
+{
+	KASSERT(int_enabled());
+
+	preempt_disable();
+	mutex_lock_imp(mutex);
+	preempt_enable();
+}
+
+/*
+ * Slow path of mutex_unlock(): there are waiters to hand the mutex to.
+ */
+static void mutex_unlock_slow(struct mutex *mutex)
+{
+	struct thread *waiter;
+
+	KASSERT(int_enabled());
+
+	preempt_disable();
+	waiter = mutex_unlock_imp(mutex);
+
+	/* the new owner runs next, using the rest of our time slice */
+	preempt_enable_yield_to(waiter);
 }
 
 /* ----------------------------------------------------------------------
@@ -95,9 +260,10 @@ static __inline__ void mutex_unlock_imp(struct mutex *mutex)
  */
 void mutex_init(struct mutex *mutex)
 {
-	mutex->state = MUTEX_UNLOCKED;
 	mutex->owner = 0;
 	thread_queue_clear(&mutex->waitqueue);
+	mutex->pi_linked = false;
+	mutex->mutex_list_prev = mutex->mutex_list_next = 0;
 }
 
 /*
@@ -105,11 +271,28 @@ void mutex_init(struct mutex *mutex)
  */
 void mutex_lock(struct mutex *mutex)
 {
+	ulong_t current = (ulong_t) percpu_read(g_current);
+
 	KASSERT(int_enabled());
 
-	g_preemption = false;
-	mutex_lock_imp(mutex);
-	g_preemption = true;
+	/* fast path: mutex is unlocked */
+	if (atomic_cmpxchg(&mutex->owner, 0, current) == 0) {
+		return;
+	}
+
+	mutex_lock_slow(mutex);
+}
+
+/*
+ * Lock given mutex if it is unlocked, without blocking.
+ * May be called with interrupts disabled.
+ * Returns true if the mutex was acquired.
+ */
+bool mutex_trylock(struct mutex *mutex)
+{
+	ulong_t current = (ulong_t) percpu_read(g_current);
+
+	return atomic_cmpxchg(&mutex->owner, 0, current) == 0;
 }
 
 /*
@@ -117,11 +300,14 @@ void mutex_lock(struct mutex *mutex)
  */
 void mutex_unlock(struct mutex *mutex)
 {
-	KASSERT(int_enabled());
+	ulong_t current = (ulong_t) percpu_read(g_current);
 
-	g_preemption = false;
-	mutex_unlock_imp(mutex);
-	g_preemption = true;
+	/* fast path: we own the mutex and nobody is waiting */
+	if (atomic_cmpxchg(&mutex->owner, current, 0) == current) {
+		return;
+	}
+
+	mutex_unlock_slow(mutex);
 }
 
 /*
@@ -143,7 +329,7 @@ void cond_wait(struct condition *cond, struct mutex *mutex)
 	KASSERT(MUTEX_IS_HELD(mutex));
 
 	/* Turn off scheduling. */
-	g_preemption = false;
+	preempt_disable();
 
 	/*
 	 * Release the mutex, but leave preemption disabled.
@@ -154,8 +340,8 @@ void cond_wait(struct condition *cond, struct mutex *mutex)
 	mutex_unlock_imp(mutex);
 
 	/*
-	 * Atomically reenable preemption and wait in the condition wait queue.
-	 * Other threads can run while this thread is waiting,
+	 * Wait in the condition wait queue.  Other threads (which have
+	 * their own preemption counts) can run while this thread is waiting,
 	 * and eventually one of them will call cond_signal() or cond_broadcast()
 	 * to wake up this thread.
 	 * On wakeup, preemption is once again disabled.
@@ -166,7 +352,32 @@ void cond_wait(struct condition *cond, struct mutex *mutex)
 	mutex_lock_imp(mutex);
 
 	/* Turn scheduling back on. */
-	g_preemption = true;
+	preempt_enable();
+}
+
+/*
+ * Wait on given condition (protected by given mutex),
+ * giving up after given number of ticks.
+ * Returns 0 if the condition was signaled, or ETIMEDOUT.
+ * The mutex is reacquired in either case.
+ */
+int cond_timedwait(struct condition *cond, struct mutex *mutex, u32_t ticks)
+{
+	bool woken;
+
+	KASSERT(int_enabled());
+	KASSERT(MUTEX_IS_HELD(mutex));
+
+	/* as in cond_wait(), release the mutex with preemption disabled */
+	preempt_disable();
+	mutex_unlock_imp(mutex);
+
+	woken = thread_park_timeout(&cond->waitqueue, ticks);
+
+	mutex_lock_imp(mutex);
+	preempt_enable();
+
+	return woken ? 0 : ETIMEDOUT;
 }
 
 /*
@@ -177,7 +388,7 @@ void cond_signal(struct condition *cond)
 {
 	KASSERT(int_enabled());
 	int_disable();  /* prevent scheduling */
-	thread_wakeup_one(&cond->waitqueue);
+	thread_wakeup_handoff(&cond->waitqueue);
 	int_enable();  /* resume scheduling */
 }
 
@@ -192,3 +403,110 @@ void cond_broadcast(struct condition *cond)
 	thread_wakeup(&cond->waitqueue);
 	int_enable();  /* resume scheduling */
 }
+
+/*
+ * Initialize given reader-writer lock.
+ */
+void rwlock_init(struct rwlock *rw)
+{
+	rw->readers = 0;
+	rw->writer = 0;
+	rw->readers_waiting = 0;
+	rw->writers_waiting = 0;
+	thread_queue_clear(&rw->read_waitqueue);
+	thread_queue_clear(&rw->write_waitqueue);
+}
+
+/*
+ * Acquire given reader-writer lock for reading.
+ */
+void rwlock_read_lock(struct rwlock *rw)
+{
+	KASSERT(int_enabled());
+
+	preempt_disable();
+	if (rw->writer == 0 && rw->writers_waiting == 0) {
+		rw->readers++;
+	} else {
+		/* the writer which admits our batch counts us as a reader */
+		rw->readers_waiting++;
+		thread_park(&rw->read_waitqueue);
+	}
+	preempt_enable();
+}
+
+/*
+ * Release given reader-writer lock held for reading.
+ */
+void rwlock_read_unlock(struct rwlock *rw)
+{
+	struct thread *waiter = 0;
+
+	KASSERT(int_enabled());
+
+	preempt_disable();
+	KASSERT(rw->readers > 0 && rw->writer == 0);
+	if (--rw->readers == 0 && rw->writers_waiting > 0) {
+		/* last reader out: hand the lock to a writer */
+		int_disable();
+		waiter = thread_wakeup_handoff(&rw->write_waitqueue);
+		int_enable();
+		rw->writer = waiter;
+		rw->writers_waiting--;
+	}
+
+	/* the new writer runs next */
+	preempt_enable_yield_to(waiter);
+}
+
+/*
+ * Acquire given reader-writer lock for writing.
+ */
+void rwlock_write_lock(struct rwlock *rw)
+{
+	struct thread *current = percpu_read(g_current);
+
+	KASSERT(int_enabled());
+
+	preempt_disable();
+	KASSERT(rw->writer != current);
+	if (rw->writer == 0 && rw->readers == 0) {
+		rw->writer = current;
+	} else {
+		/* the previous holder hands the lock to us */
+		rw->writers_waiting++;
+		thread_park(&rw->write_waitqueue);
+	}
+	KASSERT(rw->writer == current);
+	preempt_enable();
+}
+
+/*
+ * Release given reader-writer lock held for writing.
+ */
+void rwlock_write_unlock(struct rwlock *rw)
+{
+	struct thread *waiter = 0;
+
+	KASSERT(int_enabled());
+
+	preempt_disable();
+	KASSERT(rw->writer == percpu_read(g_current));
+	rw->writer = 0;
+
+	int_disable();
+	if (rw->readers_waiting > 0) {
+		/* admit all waiting readers as one batch */
+		rw->readers += rw->readers_waiting;
+		rw->readers_waiting = 0;
+		thread_wakeup(&rw->read_waitqueue);
+	} else if (rw->writers_waiting > 0) {
+		waiter = thread_wakeup_handoff(&rw->write_waitqueue);
+		rw->writer = waiter;
+		rw->writers_waiting--;
+	}
+	int_enable();
+
+	/* the new writer runs next */
+	preempt_enable_yield_to(waiter);
+}
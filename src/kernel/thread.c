@@ -25,6 +25,10 @@
 #include <geekos/int.h>
 #include <geekos/mem.h>
 #include <geekos/workqueue.h>
+#include <geekos/timer.h>
+#include <geekos/softirq.h>
+#include <geekos/rcu.h>
+#include <geekos/file.h>
 
 /*-----------------------------------------------------------------------
  * Implementation
@@ -33,17 +37,91 @@
 IMPLEMENT_LIST_CLEAR(thread_queue, thread)
 IMPLEMENT_LIST_IS_EMPTY(thread_queue, thread)
 IMPLEMENT_LIST_APPEND(thread_queue, thread)
+IMPLEMENT_LIST_PREPEND(thread_queue, thread)
 IMPLEMENT_LIST_REMOVE_FIRST(thread_queue, thread)
+IMPLEMENT_LIST_REMOVE(thread_queue, thread)
+IMPLEMENT_LIST_GET_FIRST(thread_queue, thread)
+IMPLEMENT_LIST_NEXT(thread_queue, thread)
 
-static struct thread_queue s_runqueue;
+/* one runqueue per priority level */
+static struct thread_queue s_runqueue[THREAD_NUM_PRIORITIES];
+
+/* bit n is set when s_runqueue[n] is non-empty */
+static u32_t s_runqueue_bitmap;
+
+/*
+ * The idle thread is never placed on the runqueue:
+ * it is chosen only when the runqueue is empty.
+ */
+static struct thread *s_idle_thread;
+
+/*
+ * The main thread, which runs on the boot stack (KERN_STACK)
+ * rather than on one from thread_alloc_stack().
+ */
+static struct thread *s_main_thread;
+
+/*
+ * Switch to given thread.  The preemption count belongs to the
+ * current thread, so save it across the switch: the threads which
+ * run in the meantime use their own.
+ */
+static void thread_switch(struct thread *next)
+{
+	int preempt_count = percpu_read(g_preempt_count);
+	thread_switch_to(next);
+	percpu_write(g_preempt_count, preempt_count);
+}
+
+/*
+ * Cache of exited threads with default-sized stacks, ready to be
+ * reused by thread_create().  Most recently exited threads are
+ * reused first, since their stacks are most likely to be cached.
+ */
+#define THREAD_CACHE_MAX 16
+static struct thread_queue s_thread_cache;
+static int s_thread_cache_count;
+
+static int thread_cache_shrink(struct mem_shrinker *shrinker, int nr_to_free);
+static struct mem_shrinker s_thread_cache_shrinker = {
+	"thread cache", &thread_cache_shrink, 0
+};
+
+/*
+ * Remove a ready thread from the runqueue.
+ */
+static void thread_runqueue_remove(struct thread *thread)
+{
+	KASSERT(thread->state == THREAD_READY);
+	thread_queue_remove(&s_runqueue[thread->priority], thread);
+	if (thread_queue_is_empty(&s_runqueue[thread->priority])) {
+		s_runqueue_bitmap &= ~(1UL << thread->priority);
+	}
+}
 
 /*
  * Idle thread; ensures that at least one thread is
- * always running or runnable.
+ * always running or runnable.  Halts the CPU until an interrupt
+ * arrives when there is nothing else to run.
  */
 static void thread_idle(ulong_t arg)
 {
 	while (true) {
+		int_disable();
+		if (s_runqueue_bitmap == 0) {
+			/*
+			 * Disable preemption so that the interrupt which wakes
+			 * the CPU returns here, and the tick is restarted
+			 * before any other thread runs.
+			 */
+			preempt_disable();
+			timer_idle_enter();
+			int_wait();
+			int_disable();
+			timer_idle_exit();
+			preempt_enable();
+		}
+		int_enable();
 		thread_yield();
 	}
 	/* does not return */
@@ -55,16 +133,122 @@ static void thread_idle(ulong_t arg)
 static void thread_dump_runnable(void)
 {
 	struct thread *thread;
+	int prio;
 	cons_printf("runqueue:");
-	for (thread = thread_queue_get_first(&s_runqueue);
-	     thread != 0;
-	     thread = thread_queue_next(thread)) {
-		cons_printf(" [%p]", thread);
+	for (prio = THREAD_NUM_PRIORITIES - 1; prio >= 0; prio--) {
+		for (thread = thread_queue_get_first(&s_runqueue[prio]);
+		     thread != 0;
+		     thread = thread_queue_next(thread)) {
+			cons_printf(" [%p/%d]", thread, prio);
+		}
 	}
 	cons_printf("\n");
 }
 #endif
 
+/*
+ * Allocate a kernel stack of given size.  Page-sized stacks
+ * come straight from the frame allocator; other sizes are
+ * carved from the kernel heap.
+ */
+static void *thread_alloc_stack(size_t stack_size)
+{
+	if (stack_size == PAGE_SIZE) {
+		return mem_frame_to_pa(mem_alloc_frame(FRAME_KSTACK, 0));
+	} else {
+		return mem_alloc(stack_size);
+	}
+}
+
+/*
+ * Free a kernel stack allocated with thread_alloc_stack().
+ */
+static void thread_free_stack(void *stack, size_t stack_size)
+{
+	if (stack_size == PAGE_SIZE) {
+		mem_free_frame(mem_pa_to_frame(stack));
+	} else {
+		mem_free(stack);
+	}
+}
+
+/*
+ * Try to put a thread whose refcount has reached 0 in the thread cache.
+ * Interrupts must be disabled.  This may be the current thread, on
+ * its way out of thread_exit(): since interrupts stay disabled until
+ * it switches away, nothing can reuse it before then.
+ * Returns true if the thread was cached.
+ */
+static bool thread_cache_put(struct thread *thread)
+{
+	KASSERT(!int_enabled());
+
+	/*
+	 * Threads with a process are never cached, since their address
+	 * space must be torn down by thread_destroy().  The main thread
+	 * is never cached, since the shrinker would free its stack,
+	 * which was not allocated by thread_alloc_stack().
+	 */
+	if (thread->proc != 0 || thread == s_main_thread ||
+	    thread->stack_size != THREAD_STACK_SIZE ||
+	    s_thread_cache_count >= THREAD_CACHE_MAX) {
+		return false;
+	}
+
+	thread_queue_prepend(&s_thread_cache, thread);
+	s_thread_cache_count++;
+	return true;
+}
+
+/*
+ * Take a thread from the thread cache.
+ * Returns 0 if the cache is empty.
+ */
+static struct thread *thread_cache_get(void)
+{
+	struct thread *thread;
+	bool iflag = int_begin_atomic();
+
+	thread = thread_queue_remove_first(&s_thread_cache);
+	if (thread != 0) {
+		s_thread_cache_count--;
+	}
+
+	int_end_atomic(iflag);
+	return thread;
+}
+
+/*
+ * Shrinker for the thread cache: free cached threads and their stacks.
+ */
+static int thread_cache_shrink(struct mem_shrinker *shrinker, int nr_to_free)
+{
+	struct thread *current = percpu_read(g_current);
+	struct thread *thread, *next;
+	int freed = 0;
+
+	KASSERT(!int_enabled());
+
+	for (thread = thread_queue_get_first(&s_thread_cache);
+	     thread != 0 && freed < nr_to_free;
+	     thread = next) {
+		next = thread_queue_next(thread);
+
+		/* an exiting thread is still using its stack */
+		if (thread == current) {
+			continue;
+		}
+
+		thread_queue_remove(&s_thread_cache, thread);
+		s_thread_cache_count--;
+		thread_free_stack(thread->stack, thread->stack_size);
+		mem_free(thread);
+		freed++;
+	}
+
+	return freed;
+}
+
 /*
  * Workqueue callback function to free resources used by
  * a thread that has exited or been killed.
@@ -79,7 +263,7 @@ static void thread_destroy(void *thread_)
 
 	/* TODO: user space teardown */
 
-	mem_free_frame(mem_pa_to_frame(thread->stack));
+	thread_free_stack(thread->stack, thread->stack_size);
 	mem_free(thread);
 }
 
@@ -88,16 +272,16 @@ static void thread_destroy(void *thread_)
  * Each thread detaches from itself when it exits.
  * A parent thread detaches from the child when it joins.
  * When the thread's refcount reaches 0, it is scheduled
- * for destruction by the workqueue thread.
+ * for destruction by the system workqueue.
  */
 static void thread_detach(struct thread *thread)
 {
 	KASSERT(!int_enabled());
 	KASSERT(thread->refcount > 0);
 	thread->refcount--;
-	if (thread->refcount == 0) {
+	if (thread->refcount == 0 && !thread_cache_put(thread)) {
 		/*cons_printf("scheduling thread %p for destruction by work queue\n", thread);*/
-		workqueue_schedule_work(&thread_destroy, thread);
+		workqueue_schedule_work(&thread->destroy_work);
 	}
 }
 
@@ -105,9 +289,10 @@ static void thread_detach(struct thread *thread)
  * Interface
  *----------------------------------------------------------------------- */
 
-struct thread *g_current;
-volatile int g_need_reschedule;
-volatile int g_preemption;
+DEFINE_PERCPU(struct thread *, g_current);
+DEFINE_PERCPU(volatile int, g_need_reschedule);
+DEFINE_PERCPU(volatile int, g_preempt_count);
+DEFINE_PERCPU(u32_t, g_num_switches);
 
 /*
  * Bootstrap main thread, initialize scheduler.
@@ -116,10 +301,10 @@ void thread_init(void)
 {
 	struct thread *main_thread;
 
-	KASSERT(g_current == 0);
-	KASSERT(g_need_reschedule == 0);
-	KASSERT(g_preemption == false);
-	KASSERT(thread_queue_is_empty(&s_runqueue));
+	KASSERT(percpu_read(g_current) == 0);
+	KASSERT(percpu_read(g_need_reschedule) == 0);
+	KASSERT(percpu_read(g_preempt_count) == 0);
+	KASSERT(s_runqueue_bitmap == 0);
 	KASSERT(THREAD_CONTEXT_SIZE == sizeof(struct thread_context));
 	KASSERT(THREAD_STACK_PTR_OFFSET == OFFSETOF(struct thread, stack_ptr));
 
@@ -127,34 +312,71 @@ void thread_init(void)
 	main_thread = (struct thread *) mem_alloc(sizeof(struct thread));
 	memset(main_thread, '\0', sizeof(struct thread));
 	main_thread->stack = (void *) KERN_STACK;
+	main_thread->stack_size = PAGE_SIZE;
 	main_thread->state = THREAD_RUNNING;
 	main_thread->refcount = 1;
-	g_current = main_thread;
+	main_thread->priority = THREAD_PRIO_NORMAL;
+	main_thread->base_priority = THREAD_PRIO_NORMAL;
+	work_init(&main_thread->destroy_work, &thread_destroy, main_thread);
+	percpu_write(g_current, main_thread);
+	s_main_thread = main_thread;
+
+	/* no preemption until the timer is running (see timer_init()) */
+	preempt_disable();
+
+	/* free cached threads when memory runs low */
+	mem_register_shrinker(&s_thread_cache_shrinker);
 
 	/* create idle thread */
-	thread_create(thread_idle, 0UL, THREAD_DETACHED);
+	s_idle_thread = thread_create(thread_idle, 0UL, THREAD_DETACHED);
 }
 
 /*
- * Create and start a new kernel-only thread.
+ * Create and start a new kernel-only thread with the default
+ * stack size.
  * Returns a pointer to the new kernel thread, or 0 if
  * there is not enough memory to create the new thread.
  */
 struct thread *thread_create(thread_func_t *start_func, ulong_t arg, thread_mode_t mode)
+{
+	return thread_create_stack(start_func, arg, mode, THREAD_STACK_SIZE);
+}
+
+/*
+ * Create and start a new kernel-only thread with a kernel stack
+ * of given size (at least THREAD_STACK_MIN bytes).
+ * Returns a pointer to the new kernel thread, or 0 if
+ * there is not enough memory to create the new thread.
+ */
+struct thread *thread_create_stack(thread_func_t *start_func, ulong_t arg, thread_mode_t mode,
+	size_t stack_size)
 {
 	struct thread *thread;
 	void *stack;
 
-	thread = mem_alloc(sizeof(struct thread));
-	stack = mem_frame_to_pa(mem_alloc_frame(FRAME_KSTACK, 0));
+	KASSERT(stack_size >= THREAD_STACK_MIN);
+	stack_size = (stack_size + 15) & ~15UL;
+
+	/* reuse a cached thread and stack if possible */
+	thread = (stack_size == THREAD_STACK_SIZE) ? thread_cache_get() : 0;
+	if (thread != 0) {
+		stack = thread->stack;
+	} else {
+		thread = mem_alloc(sizeof(struct thread));
+		stack = thread_alloc_stack(stack_size);
+	}
 
 	/* initialize the thread */
 	memset(thread, '\0', sizeof(struct thread));
 	thread->stack = stack;
+	thread->stack_size = stack_size;
+	thread->priority = THREAD_PRIO_NORMAL;
+	thread->base_priority = THREAD_PRIO_NORMAL;
+	work_init(&thread->destroy_work, &thread_destroy, thread);
 	thread->refcount = 1; /* each thread has an implicit self-reference */
 	if (mode == THREAD_ATTACHED) {
 		/* parent (current thread) holds a reference */
-		thread->parent = g_current;
+		thread->parent = percpu_read(g_current);
 		thread->refcount++;
 	}
 
@@ -173,7 +395,14 @@ struct thread *thread_create(thread_func_t *start_func, ulong_t arg, thread_mode
  */
 void thread_exit(int exitcode)
 {
-	struct thread *thread = g_current;
+	struct thread *thread = percpu_read(g_current);
+
+	/* close open files while the thread can still block */
+	if (thread->fd_table != 0) {
+		KASSERT(int_enabled());
+		fd_table_destroy(thread->fd_table);
+		thread->fd_table = 0;
+	}
 
 	/* make sure ints are disabled */
 	if (int_enabled()) {
@@ -207,7 +436,7 @@ int thread_join(struct thread *child)
 	bool iflag;
 	int exitcode;
 
-	KASSERT(g_current == child->parent);
+	KASSERT(percpu_read(g_current) == child->parent);
 
 	iflag = int_begin_atomic();
 
@@ -231,10 +460,23 @@ int thread_join(struct thread *child)
  */
 void thread_wait(struct thread_queue *queue)
 {
+	struct thread *current = percpu_read(g_current);
+
 	KASSERT(!int_enabled());
+
+	/* let the workqueue know its worker is blocking */
+	if (current->wq_worker != 0) {
+		workqueue_worker_sleeping(current->wq_worker);
+	}
+
 	thread_relinquish_cpu();
-	thread_queue_append(queue, g_current);
+	thread_queue_append(queue, current);
+	current->wait_queue = queue;
 	thread_schedule();
+
+	if (current->wq_worker != 0) {
+		workqueue_worker_waking(current->wq_worker);
+	}
 }
 
 /*
@@ -243,15 +485,85 @@ void thread_wait(struct thread_queue *queue)
  */
 void thread_park(struct thread_queue *queue)
 {
-	KASSERT(!g_preemption);
+	KASSERT(!preemptible());
 
+	/* other threads run with their own preemption counts while we wait */
 	int_disable();
-	g_preemption = true;
 	thread_wait(queue);
-	g_preemption = false;
 	int_enable();
 }
 
+/*
+ * Timer callback for timed waits: if the thread is still waiting,
+ * remove it from its wait queue and make it runnable.
+ */
+static void thread_wait_expired(void *thread_)
+{
+	struct thread *thread = thread_;
+
+	KASSERT(!int_enabled());
+
+	if (thread->wait_queue != 0) {
+		thread_queue_remove(thread->wait_queue, thread);
+		thread->wait_queue = 0;
+		thread->timed_out = true;
+		thread_make_runnable(thread);
+	}
+}
+
+/*
+ * Like thread_wait(), but give up waiting after given number of ticks.
+ * Returns true if the thread was woken up, false if the wait timed out.
+ */
+bool thread_wait_timeout(struct thread_queue *queue, u32_t ticks)
+{
+	struct thread *current = percpu_read(g_current);
+	struct timer timer;
+
+	KASSERT(!int_enabled());
+
+	current->timed_out = false;
+	timer_setup(&timer, &thread_wait_expired, current);
+	timer_arm(&timer, ticks);
+
+	thread_wait(queue);
+
+	timer_cancel(&timer);
+	return !current->timed_out;
+}
+
+/*
+ * Like thread_park(), but give up waiting after given number of ticks.
+ * Returns true if the thread was woken up, false if the wait timed out.
+ */
+bool thread_park_timeout(struct thread_queue *queue, u32_t ticks)
+{
+	bool woken;
+
+	KASSERT(!preemptible());
+
+	int_disable();
+	woken = thread_wait_timeout(queue, ticks);
+	int_enable();
+
+	return woken;
+}
+
+/*
+ * Put the current thread to sleep for given number of ticks.
+ */
+void thread_sleep(u32_t ticks)
+{
+	bool iflag;
+	struct thread_queue queue;
+
+	thread_queue_clear(&queue);
+
+	iflag = int_begin_atomic();
+	thread_wait_timeout(&queue, ticks);
+	int_end_atomic(iflag);
+}
+
 /*
  * Wake up all threads waiting in given thread queue.
  */
@@ -271,10 +583,56 @@ void thread_wakeup_one(struct thread_queue *queue)
 	struct thread *thread = thread_queue_remove_first(queue);
 	if (thread) {
 		/*cons_printf("waking up thread %p\n", thread);*/
+		thread->wait_queue = 0;
 		thread_make_runnable(thread);
 	}
 }
 
+/*
+ * Wake up the first thread waiting in given thread queue, placing
+ * it at the front of its runqueue so that it runs before any other
+ * thread of the same priority.  Used when the waker has just handed
+ * the waiter a resource (a mutex, a completed request): pair with
+ * thread_yield_to() to run the waiter immediately.  The returned
+ * pointer is only valid until the woken thread gets to run, so it
+ * must not be used once interrupts and preemption are enabled again.
+ * Returns the woken thread, or 0 if the queue was empty.
+ */
+struct thread *thread_wakeup_handoff(struct thread_queue *queue)
+{
+	struct thread *thread;
+
+	KASSERT(!int_enabled());
+	thread = thread_queue_remove_first(queue);
+	if (thread) {
+		thread->wait_queue = 0;
+		thread_make_runnable_first(thread);
+	}
+	return thread;
+}
+
+/*
+ * Like thread_wakeup_handoff(), but wake the highest-priority
+ * waiter (the longest-waiting one among equals).
+ */
+struct thread *thread_wakeup_handoff_highest(struct thread_queue *queue)
+{
+	struct thread *thread, *best = 0;
+
+	KASSERT(!int_enabled());
+	for (thread = thread_queue_get_first(queue); thread != 0; thread = thread_queue_next(thread)) {
+		if (best == 0 || thread->priority > best->priority) {
+			best = thread;
+		}
+	}
+	if (best) {
+		thread_queue_remove(queue, best);
+		best->wait_queue = 0;
+		thread_make_runnable_first(best);
+	}
+	return best;
+}
+
 /*
  * Wait until given thread predicate returns true.
  */
@@ -302,7 +660,7 @@ bool thread_refcount_is_zero(struct thread *thread)
 bool thread_not_running(struct thread *thread)
 {
 	KASSERT(thread->refcount > 0);
-	KASSERT(thread->parent == g_current);
+	KASSERT(thread->parent == percpu_read(g_current));
 	return thread->state == THREAD_EXITED || thread->state == THREAD_KILLED;
 }
 
@@ -313,17 +671,87 @@ void thread_yield(void)
 {
 	bool iflag = int_begin_atomic();
 	thread_relinquish_cpu();
-	thread_make_runnable(g_current);
+	thread_make_runnable(percpu_read(g_current));
 	thread_schedule();
 	int_end_atomic(iflag);
 }
 
+/*
+ * Yield the CPU directly to given thread, which runs with the
+ * remainder of the current thread's time slice.  The current
+ * thread goes to the back of the runqueue.  Does nothing if the
+ * thread is not runnable or has lower priority than the current
+ * thread; in interrupt context, or when preemption is disabled,
+ * requests a reschedule instead (the thread should be at the front
+ * of its runqueue), so that callers releasing a lock never block.
+ * Interrupts must be disabled, and the thread must not have had a
+ * chance to run since it was woken: otherwise it may have exited.
+ */
+void thread_yield_to(struct thread *thread)
+{
+	struct thread *current = percpu_read(g_current);
+
+	KASSERT(!int_enabled());
+
+	if (thread == current || thread->state != THREAD_READY ||
+	    thread == s_idle_thread || thread->priority < current->priority) {
+		return;
+	}
+
+	if (softirq_in_interrupt()) {
+		percpu_write(g_need_reschedule, true);
+		return;
+	}
+
+	if (!preemptible()) {
+		percpu_write(g_need_reschedule, true);
+		return;
+	}
+
+	rcu_note_quiescent_state();
+
+	/* take the thread off the runqueue, and give it our slice */
+	thread_runqueue_remove(thread);
+	thread->num_ticks = current->num_ticks;
+	thread->state = THREAD_RUNNING;
+
+	thread_relinquish_cpu();
+	thread_make_runnable(current);
+	thread_switch(thread);
+}
+
+/*
+ * Re-enable preemption after handing a resource to the thread
+ * returned by thread_wakeup_handoff*(), and yield to that thread
+ * (if nonzero).  Preemption must be disabled exactly once more than
+ * it was when the thread was woken, and interrupts must be enabled.
+ * The yield happens before the preemption point, so that the thread
+ * cannot run (and exit) before thread_yield_to() looks at it.
+ */
+void preempt_enable_yield_to(struct thread *thread)
+{
+	KASSERT(int_enabled());
+
+	/* with interrupts disabled, preempt_enable() does not reschedule */
+	int_disable();
+	preempt_enable();
+	if (thread != 0) {
+		thread_yield_to(thread);
+	}
+	int_enable();
+
+	/* a reschedule requested for another reason */
+	if (preemptible() && percpu_read(g_need_reschedule)) {
+		preempt_schedule();
+	}
+}
+
 /*
  * Called to indicate that the current thread is giving up the CPU.
  */
 void thread_relinquish_cpu(void)
 {
-	struct thread *thread = g_current;
+	struct thread *thread = percpu_read(g_current);
 	KASSERT(thread->state == THREAD_RUNNING);
 
 	/* FIXME: sample num_ticks */
@@ -340,20 +768,116 @@ struct thread *thread_next_runnable(void)
 #ifdef DEBUG_RUNQUEUE
 	thread_dump_runnable();
 #endif
-	next = thread_queue_remove_first(&s_runqueue);
+
+	/* the current thread is leaving the CPU, so it is not in an RCU reader */
+	rcu_note_quiescent_state();
+
+	if (s_runqueue_bitmap == 0) {
+		next = s_idle_thread;
+	} else {
+		/* take the first thread at the highest non-empty priority */
+		int prio = THREAD_NUM_PRIORITIES - 1;
+		while (!(s_runqueue_bitmap & (1UL << prio))) {
+			prio--;
+		}
+		next = thread_queue_remove_first(&s_runqueue[prio]);
+		if (thread_queue_is_empty(&s_runqueue[prio])) {
+			s_runqueue_bitmap &= ~(1UL << prio);
+		}
+	}
 	KASSERT(next);
 	next->state = THREAD_RUNNING;
 	return next;
 }
 
 /*
- * Add given thread to the runqueue.
+ * Add given thread to the front or back of the runqueue
+ * for its priority.
  */
-void thread_make_runnable(struct thread *thread)
+static void thread_enqueue(struct thread *thread, bool first)
 {
 	bool iflag = int_begin_atomic();
+	struct thread *current = percpu_read(g_current);
+
 	thread->state = THREAD_READY;
-	thread_queue_append(&s_runqueue, thread);
+	if (thread != s_idle_thread) {
+		if (first) {
+			thread_queue_prepend(&s_runqueue[thread->priority], thread);
+		} else {
+			thread_queue_append(&s_runqueue[thread->priority], thread);
+		}
+		s_runqueue_bitmap |= (1UL << thread->priority);
+
+		/* a more important thread should run as soon as possible */
+		if (current != 0 && thread != current && thread->priority > current->priority) {
+			percpu_write(g_need_reschedule, true);
+		}
+	}
+	int_end_atomic(iflag);
+}
+
+/*
+ * Add given thread to the runqueue.
+ */
+void thread_make_runnable(struct thread *thread)
+{
+	thread_enqueue(thread, false);
+}
+
+/*
+ * Add given thread to the front of the runqueue, so that it
+ * runs next among threads of its priority.
+ */
+void thread_make_runnable_first(struct thread *thread)
+{
+	thread_enqueue(thread, true);
+}
+
+/*
+ * Set the base scheduling priority of given thread.
+ */
+void thread_set_priority(struct thread *thread, int priority)
+{
+	bool iflag;
+
+	KASSERT(priority >= THREAD_PRIO_MIN && priority <= THREAD_PRIO_MAX);
+
+	iflag = int_begin_atomic();
+	thread->base_priority = priority;
+	thread_update_priority(thread);
+	int_end_atomic(iflag);
+}
+
+/*
+ * Recompute the effective priority of given thread: its base
+ * priority, raised to pi_priority if it holds a mutex that
+ * a more important thread is waiting for.
+ */
+void thread_update_priority(struct thread *thread)
+{
+	bool iflag;
+	int priority = thread->base_priority;
+
+	if (thread->pi_priority > priority) {
+		priority = thread->pi_priority;
+	}
+
+	iflag = int_begin_atomic();
+	if (priority != thread->priority) {
+		if (thread->state == THREAD_READY && thread != s_idle_thread) {
+			/* move to the runqueue for the new priority */
+			thread_runqueue_remove(thread);
+			thread->priority = priority;
+			thread_make_runnable(thread);
+		} else {
+			thread->priority = priority;
+		}
+
+		/* if the current thread lost its boost, something else may need to run */
+		if (thread == percpu_read(g_current) && s_runqueue_bitmap >= (2UL << priority)) {
+			percpu_write(g_need_reschedule, true);
+		}
+	}
 	int_end_atomic(iflag);
 }
 
@@ -365,5 +889,25 @@ void thread_make_runnable(struct thread *thread)
 void thread_schedule(void)
 {
 	KASSERT(!int_enabled());
-	thread_switch_to(thread_next_runnable());
+	/* interrupt handlers and softirqs run on the shared interrupt stack and must not block */
+	KASSERT(!softirq_in_interrupt());
+	thread_switch(thread_next_runnable());
+}
+
+/*
+ * Called from preempt_enable() when the preemption count drops to 0
+ * and a reschedule was requested while preemption was disabled.
+ */
+void preempt_schedule(void)
+{
+	struct thread *current = percpu_read(g_current);
+
+	int_disable();
+	if (percpu_read(g_need_reschedule) && preemptible()) {
+		percpu_write(g_need_reschedule, false);
+		thread_relinquish_cpu();
+		thread_make_runnable(current);
+		thread_schedule();
+	}
+	int_enable();
 }
@@ -0,0 +1,533 @@
+/*
+ * GeekOS - work-stealing kernel thread pool
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <geekos/threadpool.h>
+#include <geekos/thread.h>
+#include <geekos/atomic.h>
+#include <geekos/percpu.h>
+#include <geekos/int.h>
+#include <geekos/mem.h>
+#include <geekos/kassert.h>
+
+/*
+ * NOTES:
+ * - Each worker owns a Chase-Lev deque: the owner pushes and pops
+ *   at the bottom, thieves steal from the top with a compare-and-swap.
+ *   Only the owning worker thread may push or pop its deque.
+ * - Threads which are not pool workers spawn tasks into a shared
+ *   injection queue, which is protected by disabling interrupts.
+ * - The decision to put a worker to sleep is made with interrupts
+ *   disabled, after checking every deque and the injection queue.
+ *   As with the rest of the kernel's interrupt-based locking, this
+ *   assumes a uniprocessor; with multiple CPUs running the pool,
+ *   the idle queue needs a spinlock.
+ */
+
+/* ----------------------------------------------------------------------
+ * Private data
+ * ---------------------------------------------------------------------- */
+
+/* capacity of a worker deque (must be a power of 2) */
+#define TASK_DEQUE_SIZE 256
+#define TASK_DEQUE_MASK (TASK_DEQUE_SIZE - 1)
+
+/*
+ * Chase-Lev work-stealing deque.
+ * top and bottom increase monotonically; the live tasks are
+ * those with indices in [top, bottom).
+ */
+struct task_deque {
+	volatile ulong_t top;                     /* steal end */
+	volatile ulong_t bottom;                  /* owner end */
+	struct task *volatile buf[TASK_DEQUE_SIZE];
+};
+
+struct threadpool_worker {
+	struct task_deque deque;
+	struct thread *thread;
+	u32_t rand_state;        /* xorshift state for victim selection */
+	int index;
+};
+
+IMPLEMENT_LIST_CLEAR(task_list, task)
+IMPLEMENT_LIST_IS_EMPTY(task_list, task)
+IMPLEMENT_LIST_APPEND(task_list, task)
+IMPLEMENT_LIST_REMOVE_FIRST(task_list, task)
+
+static struct threadpool_worker *s_workers[THREADPOOL_MAX_WORKERS];
+static int s_num_workers;
+
+/* tasks spawned by threads which are not pool workers */
+static struct task_list s_injection_queue;
+
+/* queue in which idle workers wait for tasks */
+static struct thread_queue s_idle_queue;
+static int s_num_idle;
+
+/* ----------------------------------------------------------------------
+ * Deque operations
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Push a task on the bottom of a deque (owner only).
+ * Returns false if the deque is full.
+ */
+static bool task_deque_push(struct task_deque *dq, struct task *task)
+{
+	ulong_t b = dq->bottom;
+	ulong_t t = dq->top;
+
+	if ((long) (b - t) >= TASK_DEQUE_SIZE) {
+		return false;
+	}
+
+	dq->buf[b & TASK_DEQUE_MASK] = task;
+
+	/* stores are not reordered with other stores on x86 */
+	compiler_barrier();
+	dq->bottom = b + 1;
+	return true;
+}
+
+/*
+ * Pop a task from the bottom of a deque (owner only).
+ * Returns 0 if the deque is empty.
+ */
+static struct task *task_deque_pop(struct task_deque *dq)
+{
+	ulong_t b, t;
+	struct task *task;
+
+	b = dq->bottom - 1;
+	dq->bottom = b;
+
+	/* the store to bottom must be visible before top is read */
+	mem_barrier();
+	t = dq->top;
+
+	if ((long) (b - t) < 0) {
+		/* deque was empty */
+		dq->bottom = t;
+		return 0;
+	}
+
+	task = dq->buf[b & TASK_DEQUE_MASK];
+	if (b == t) {
+		/* last task: race against thieves for it */
+		if (atomic_cmpxchg(&dq->top, t, t + 1) != t) {
+			task = 0;
+		}
+		dq->bottom = t + 1;
+	}
+
+	return task;
+}
+
+/*
+ * Steal a task from the top of a deque (any thread).
+ * Returns 0 if the deque is empty or the steal lost a race.
+ */
+static struct task *task_deque_steal(struct task_deque *dq)
+{
+	ulong_t t, b;
+	struct task *task;
+
+	t = dq->top;
+	mem_barrier();
+	b = dq->bottom;
+
+	if ((long) (b - t) <= 0) {
+		return 0;
+	}
+
+	task = dq->buf[t & TASK_DEQUE_MASK];
+	if (atomic_cmpxchg(&dq->top, t, t + 1) != t) {
+		return 0;
+	}
+
+	return task;
+}
+
+static bool task_deque_is_empty(struct task_deque *dq)
+{
+	return (long) (dq->bottom - dq->top) <= 0;
+}
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Get the pool worker object for the current thread,
+ * or 0 if the current thread is not a pool worker.
+ */
+static struct threadpool_worker *threadpool_current_worker(void)
+{
+	return percpu_read(g_current)->pool_worker;
+}
+
+static u32_t threadpool_rand(struct threadpool_worker *worker)
+{
+	u32_t x = worker->rand_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	worker->rand_state = x;
+	return x;
+}
+
+/*
+ * Wake up one idle worker, if there is one.
+ */
+static void threadpool_wake_idle(void)
+{
+	bool iflag = int_begin_atomic();
+	if (s_num_idle > 0) {
+		thread_wakeup_one(&s_idle_queue);
+	}
+	int_end_atomic(iflag);
+}
+
+static struct task *threadpool_take_injected(void)
+{
+	struct task *task = 0;
+	bool iflag = int_begin_atomic();
+	if (!task_list_is_empty(&s_injection_queue)) {
+		task = task_list_remove_first(&s_injection_queue);
+	}
+	int_end_atomic(iflag);
+	return task;
+}
+
+/*
+ * Try to steal a task from some worker other than the given one,
+ * starting at a random victim.
+ */
+static struct task *threadpool_steal(struct threadpool_worker *self)
+{
+	int i, start;
+	struct task *task;
+
+	if (s_num_workers == 0) {
+		return 0;
+	}
+
+	start = self ? threadpool_rand(self) % s_num_workers : 0;
+	for (i = 0; i < s_num_workers; i++) {
+		struct threadpool_worker *victim = s_workers[(start + i) % s_num_workers];
+		if (victim == self) {
+			continue;
+		}
+		task = task_deque_steal(&victim->deque);
+		if (task != 0) {
+			return task;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Find a task for the current thread to run:
+ * its own deque first, then the injection queue, then other workers.
+ */
+static struct task *threadpool_find_task(struct threadpool_worker *self)
+{
+	struct task *task = 0;
+
+	if (self != 0) {
+		task = task_deque_pop(&self->deque);
+	}
+	if (task == 0) {
+		task = threadpool_take_injected();
+	}
+	if (task == 0) {
+		task = threadpool_steal(self);
+	}
+	return task;
+}
+
+/*
+ * Return true if any task is available anywhere in the pool.
+ * Interrupts must be disabled.
+ */
+static bool threadpool_has_work(void)
+{
+	int i;
+
+	KASSERT(!int_enabled());
+
+	if (!task_list_is_empty(&s_injection_queue)) {
+		return true;
+	}
+	for (i = 0; i < s_num_workers; i++) {
+		if (!task_deque_is_empty(&s_workers[i]->deque)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Run a task and account for its completion in its group.
+ */
+static void threadpool_run_task(struct task *task)
+{
+	struct task_group *group = task->group;
+
+	task->func(task->arg);
+
+	if (atomic_add_return(&group->pending, -1) == 0) {
+		bool iflag = int_begin_atomic();
+		thread_wakeup(&group->waitqueue);
+		int_end_atomic(iflag);
+	}
+}
+
+/*
+ * Pool worker thread: run tasks until there are none left,
+ * then sleep until more are spawned.
+ */
+static void threadpool_worker_thread(ulong_t arg)
+{
+	struct threadpool_worker *worker = (struct threadpool_worker *) arg;
+
+	worker->thread = percpu_read(g_current);
+	worker->thread->pool_worker = worker;
+
+	while (true) {
+		struct task *task = threadpool_find_task(worker);
+
+		if (task != 0) {
+			threadpool_run_task(task);
+			continue;
+		}
+
+		int_disable();
+		if (!threadpool_has_work()) {
+			s_num_idle++;
+			thread_wait(&s_idle_queue);
+			s_num_idle--;
+		}
+		int_enable();
+	}
+}
+
+/* ----------------------------------------------------------------------
+ * Parallel for loop
+ * ---------------------------------------------------------------------- */
+
+struct parallel_for {
+	parallel_for_func_t *body;
+	void *arg;
+	ulong_t grain;
+};
+
+struct parallel_for_chunk {
+	struct task task;
+	struct parallel_for *pf;
+	ulong_t start, end;
+};
+
+static void parallel_for_range(struct parallel_for *pf, ulong_t start, ulong_t end);
+
+static void parallel_for_chunk_func(void *arg)
+{
+	struct parallel_for_chunk *chunk = arg;
+	parallel_for_range(chunk->pf, chunk->start, chunk->end);
+}
+
+/*
+ * Recursively split [start, end) in half, spawning the upper half
+ * and processing the lower half inline, until ranges are no larger
+ * than the grain size.
+ */
+static void parallel_for_range(struct parallel_for *pf, ulong_t start, ulong_t end)
+{
+	struct task_group group;
+	struct parallel_for_chunk upper;
+	ulong_t mid;
+
+	if (end - start <= pf->grain) {
+		pf->body(start, end, pf->arg);
+		return;
+	}
+
+	mid = start + (end - start) / 2;
+
+	task_group_init(&group);
+	upper.pf = pf;
+	upper.start = mid;
+	upper.end = end;
+	task_init(&upper.task, &parallel_for_chunk_func, &upper);
+	task_group_spawn(&group, &upper.task);
+
+	parallel_for_range(pf, start, mid);
+
+	task_group_wait(&group);
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Create the pool worker threads: one per CPU.
+ * On a uniprocessor, no workers are created and
+ * spawned tasks run inline.
+ */
+void threadpool_init(void)
+{
+	int i, num_workers;
+
+	task_list_clear(&s_injection_queue);
+	thread_queue_clear(&s_idle_queue);
+
+	num_workers = (g_num_cpus > 1) ? g_num_cpus : 0;
+	if (num_workers > THREADPOOL_MAX_WORKERS) {
+		num_workers = THREADPOOL_MAX_WORKERS;
+	}
+
+	for (i = 0; i < num_workers; i++) {
+		struct threadpool_worker *worker = mem_alloc(sizeof(struct threadpool_worker));
+		worker->index = i;
+		worker->rand_state = 2463534242UL + i;
+		s_workers[i] = worker;
+	}
+	s_num_workers = num_workers;
+
+	for (i = 0; i < num_workers; i++) {
+		thread_create(&threadpool_worker_thread, (ulong_t) s_workers[i], THREAD_DETACHED);
+	}
+}
+
+/*
+ * Get the number of pool worker threads.
+ */
+int threadpool_num_workers(void)
+{
+	return s_num_workers;
+}
+
+/*
+ * Initialize a task.
+ */
+void task_init(struct task *task, void (*func)(void *arg), void *arg)
+{
+	task->func = func;
+	task->arg = arg;
+	task->group = 0;
+}
+
+/*
+ * Initialize a task group.
+ */
+void task_group_init(struct task_group *group)
+{
+	group->pending = 0;
+	thread_queue_clear(&group->waitqueue);
+}
+
+/*
+ * Spawn a task in given group.  The task may start running
+ * immediately on another CPU, so it must be fully initialized.
+ * The task and group must remain valid until task_group_wait()
+ * returns.
+ */
+void task_group_spawn(struct task_group *group, struct task *task)
+{
+	struct threadpool_worker *self;
+
+	task->group = group;
+	atomic_inc(&group->pending);
+
+	/* no workers: degrade to inline execution */
+	if (s_num_workers == 0) {
+		threadpool_run_task(task);
+		return;
+	}
+
+	self = threadpool_current_worker();
+	if (self != 0) {
+		if (!task_deque_push(&self->deque, task)) {
+			/* deque is full: don't bother deferring the task */
+			threadpool_run_task(task);
+			return;
+		}
+	} else {
+		bool iflag = int_begin_atomic();
+		task_list_append(&s_injection_queue, task);
+		int_end_atomic(iflag);
+	}
+
+	threadpool_wake_idle();
+}
+
+/*
+ * Wait for all tasks spawned in given group to finish.
+ * The calling thread runs available tasks while it waits.
+ */
+void task_group_wait(struct task_group *group)
+{
+	struct threadpool_worker *self = threadpool_current_worker();
+
+	while (group->pending > 0) {
+		struct task *task = threadpool_find_task(self);
+
+		if (task != 0) {
+			threadpool_run_task(task);
+			continue;
+		}
+
+		/* nothing to help with: sleep until the group finishes */
+		int_disable();
+		while (group->pending > 0) {
+			thread_wait(&group->waitqueue);
+		}
+		int_enable();
+	}
+}
+
+/*
+ * Invoke body on subranges of [start, end), in parallel
+ * where possible.  Each subrange contains at most grain indices.
+ * Returns when the entire range has been processed.
+ */
+void parallel_for(ulong_t start, ulong_t end, ulong_t grain,
+	parallel_for_func_t *body, void *arg)
+{
+	struct parallel_for pf;
+
+	if (start >= end) {
+		return;
+	}
+
+	pf.body = body;
+	pf.arg = arg;
+	pf.grain = (grain == 0) ? 1 : grain;
+
+	/* with no workers, there is nothing to gain from splitting */
+	if (s_num_workers == 0) {
+		body(start, end, arg);
+		return;
+	}
+
+	parallel_for_range(&pf, start, end);
+}
@@ -20,24 +20,365 @@
 
 #include <geekos/timer.h>
 #include <geekos/thread.h>
+#include <geekos/int.h>
+#include <geekos/kassert.h>
+#include <geekos/rcu.h>
+#include <geekos/softirq.h>
 
-/* number of ticks in one quantum */
-#define TIMER_QUANTUM 4
+/*
+ * NOTES:
+ * - Armed timers are kept in a hierarchical timing wheel:
+ *   one level of 256 buckets with a resolution of one tick,
+ *   and four levels of 64 buckets, each 64 times coarser than
+ *   the one below it.  Arming and cancelling a timer is O(1).
+ * - When the finest level wraps around, the timers in the next
+ *   level's current bucket are redistributed ("cascaded") into
+ *   finer buckets.  Each timer is cascaded at most once per level,
+ *   so expiry is amortized O(1) per timer.
+ * - All timer state is protected by disabling interrupts.
+ * - The timer interrupt only counts ticks.  Expired timers are run
+ *   by the timer softirq, on the way out of the interrupt; if several
+ *   ticks pass before it runs, their timers are run in one batch.
+ * - In tickless mode, the idle thread stops the periodic tick and
+ *   programs a one-shot interrupt for the next timer expiry
+ *   (or the next cascade, whichever comes first).  The ticks that
+ *   passed while the tick was stopped are accounted for when it
+ *   is restarted.
+ */
+
+/* length of a quantum in milliseconds, and in ticks */
+#define TIMER_QUANTUM_MS 10
+#define TIMER_QUANTUM \
+	(TIMER_MS_TO_TICKS(TIMER_QUANTUM_MS) > 0 ? TIMER_MS_TO_TICKS(TIMER_QUANTUM_MS) : 1)
+
+/* timer wheel geometry */
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVN_LEVELS 4
+
+/* index into level N of the outer wheels for given tick */
+#define TVN_INDEX(ticks, n) (((ticks) >> (TVR_BITS + (n) * TVN_BITS)) & TVN_MASK)
+
+IMPLEMENT_LIST_CLEAR(timer_list, timer)
+IMPLEMENT_LIST_IS_EMPTY(timer_list, timer)
+IMPLEMENT_LIST_APPEND(timer_list, timer)
+IMPLEMENT_LIST_APPEND_ALL(timer_list, timer)
+IMPLEMENT_LIST_REMOVE_FIRST(timer_list, timer)
+IMPLEMENT_LIST_REMOVE(timer_list, timer)
+IMPLEMENT_LIST_NEXT(timer_list, timer)
 
 volatile u32_t g_numticks;
 
+/* the timer wheel (empty lists are all-zero, so no initialization needed) */
+static struct timer_list s_tv1[TVR_SIZE];
+static struct timer_list s_tvn[TVN_LEVELS][TVN_SIZE];
+
+/* next tick whose timers have not been processed */
+static u32_t s_timer_ticks;
+
+#ifdef TIMER_TICKLESS
+/* true while the periodic tick is stopped */
+static bool s_tick_stopped;
+#endif
+
+/*
+ * Put an armed timer into the appropriate timer wheel bucket.
+ */
+static void timer_enqueue(struct timer *timer)
+{
+	u32_t expires = timer->expires;
+	u32_t delta = expires - s_timer_ticks;
+	struct timer_list *bucket;
+	int n;
+
+	if ((long) delta < 0) {
+		/* already due: process on the next tick */
+		bucket = &s_tv1[s_timer_ticks & TVR_MASK];
+	} else if (delta < TVR_SIZE) {
+		bucket = &s_tv1[expires & TVR_MASK];
+	} else {
+		for (n = 0; n < TVN_LEVELS - 1; n++) {
+			if (delta < (1UL << (TVR_BITS + (n + 1) * TVN_BITS))) {
+				break;
+			}
+		}
+		bucket = &s_tvn[n][TVN_INDEX(expires, n)];
+	}
+
+	timer->bucket = bucket;
+	timer_list_append(bucket, timer);
+}
+
+/*
+ * Redistribute the timers in a bucket of an outer wheel level.
+ * Returns the index of the bucket, which is 0 when the
+ * level itself has wrapped around.
+ */
+static int timer_cascade(int n, int index)
+{
+	struct timer_list list;
+
+	timer_list_clear(&list);
+	timer_list_append_all(&list, &s_tvn[n][index]);
+
+	while (!timer_list_is_empty(&list)) {
+		timer_enqueue(timer_list_remove_first(&list));
+	}
+
+	return index;
+}
+
+/*
+ * Run all timers that have expired.
+ * Called from the timer softirq, with interrupts disabled.
+ */
+static void timer_run(void)
+{
+	KASSERT(!int_enabled());
+
+	while ((long) (g_numticks - s_timer_ticks) >= 0) {
+		int index = s_timer_ticks & TVR_MASK;
+		struct timer_list expired;
+		struct timer *timer;
+
+		/* when the finest wheel wraps, cascade from the outer levels */
+		if (index == 0 &&
+		    timer_cascade(0, TVN_INDEX(s_timer_ticks, 0)) == 0 &&
+		    timer_cascade(1, TVN_INDEX(s_timer_ticks, 1)) == 0 &&
+		    timer_cascade(2, TVN_INDEX(s_timer_ticks, 2)) == 0) {
+			timer_cascade(3, TVN_INDEX(s_timer_ticks, 3));
+		}
+
+		++s_timer_ticks;
+
+		/*
+		 * Move expired timers to a private list, so that
+		 * periodic timers can be re-armed (and callbacks may
+		 * cancel timers) while the list is being processed.
+		 */
+		timer_list_clear(&expired);
+		timer_list_append_all(&expired, &s_tv1[index]);
+		for (timer = expired.head; timer != 0; timer = timer_list_next(timer)) {
+			timer->bucket = &expired;
+		}
+
+		while (!timer_list_is_empty(&expired)) {
+			timer = timer_list_remove_first(&expired);
+			timer->bucket = 0;
+			if (timer->period != 0) {
+				timer->expires += timer->period;
+				timer_enqueue(timer);
+			}
+			timer->func(timer->data);
+		}
+	}
+}
+
+/*
+ * Timer softirq action.
+ */
+static void timer_softirq_action(void)
+{
+	int_disable();
+	timer_run();
+	int_enable();
+}
+
+#ifdef TIMER_TICKLESS
+/*
+ * Return the number of ticks until the next timer wheel event
+ * (timer expiry or cascade), up to given limit.
+ */
+static u32_t timer_ticks_until_next_event(u32_t limit)
+{
+	u32_t delta;
+
+	/* s_timer_ticks is the next tick to process, i.e. g_numticks + 1 */
+	for (delta = 0; delta < limit; delta++) {
+		u32_t ticks = s_timer_ticks + delta;
+		if ((ticks & TVR_MASK) == 0 || !timer_list_is_empty(&s_tv1[ticks & TVR_MASK])) {
+			break;
+		}
+	}
+	return delta + 1;
+}
+#endif
+
 /*
  * Process a single timer tick.
- * Called from timer interrupt handler function.
+ * Called from the timer interrupt handler.
  */
 void timer_process_tick(void)
 {
+	/* a tick which interrupted preemptible thread code is an RCU quiescent state */
+	if (preemptible() && percpu_read(g_int_nesting) == 1) {
+		rcu_note_quiescent_state();
+	}
+
+#ifdef TIMER_TICKLESS
+	if (s_tick_stopped) {
+		/* the one-shot interrupt fired: the whole interval has passed */
+		s_tick_stopped = false;
+		timer_process_ticks(timer_restart_tick(true));
+		return;
+	}
+#endif
+	timer_process_ticks(1);
+}
+
+/*
+ * Process given number of elapsed timer ticks.
+ * Called from the timer interrupt handler, or with
+ * interrupts disabled when the periodic tick is restarted.
+ */
+void timer_process_ticks(u32_t ticks)
+{
+	struct thread *current = percpu_read(g_current);
+
+	KASSERT(!int_enabled());
+
+	if (ticks == 0) {
+		return;
+	}
+
 	/* update global tick counter and current thread's tick counter */
-	++g_numticks;
-	g_current->num_ticks++;
+	g_numticks += ticks;
+	current->num_ticks += ticks;
+
+	/* fire expired timers, once the interrupt handler is done */
+	softirq_raise(SOFTIRQ_TIMER);
 
 	/* if current thread has used an entire quantum, force new thread to be scheduled */
-	if (g_current->num_ticks > TIMER_QUANTUM) {
-		g_need_reschedule = 1;
+	if (current->num_ticks > TIMER_QUANTUM) {
+		percpu_write(g_need_reschedule, 1);
+	}
+}
+
+/*
+ * Register the timer softirq.  Called by timer_init()
+ * before the timer interrupt is enabled.
+ */
+void timer_softirq_init(void)
+{
+	softirq_register(SOFTIRQ_TIMER, &timer_softirq_action);
+}
+
+/*
+ * Called by the idle thread, with interrupts disabled, before halting.
+ * In tickless mode, stops the periodic tick until the next timer event.
+ */
+void timer_idle_enter(void)
+{
+#ifdef TIMER_TICKLESS
+	u32_t ticks;
+
+	KASSERT(!int_enabled());
+	KASSERT(!s_tick_stopped);
+
+	ticks = timer_ticks_until_next_event(timer_max_oneshot_ticks());
+	if (ticks > 1) {
+		s_tick_stopped = true;
+		timer_stop_tick(ticks);
+	}
+#endif
+}
+
+/*
+ * Called by the idle thread, with interrupts disabled, after
+ * being woken by an interrupt.  Restarts the periodic tick
+ * and accounts for the ticks that passed while it was stopped.
+ */
+void timer_idle_exit(void)
+{
+#ifdef TIMER_TICKLESS
+	KASSERT(!int_enabled());
+
+	if (s_tick_stopped) {
+		/* woken by some other interrupt */
+		s_tick_stopped = false;
+		timer_process_ticks(timer_restart_tick(false));
 	}
+#endif
+}
+
+/*
+ * Initialize a timer.
+ */
+void timer_setup(struct timer *timer, void (*func)(void *), void *data)
+{
+	timer->func = func;
+	timer->data = data;
+	timer->expires = 0;
+	timer->period = 0;
+	timer->bucket = 0;
+}
+
+/*
+ * Arm a one-shot timer to fire after given number of ticks.
+ * If the timer is already armed, it is re-armed.
+ */
+void timer_arm(struct timer *timer, u32_t ticks)
+{
+	bool iflag = int_begin_atomic();
+
+	timer_cancel(timer);
+	timer->expires = g_numticks + ticks;
+	timer->period = 0;
+	timer_enqueue(timer);
+
+	int_end_atomic(iflag);
+}
+
+/*
+ * Arm a periodic timer to fire every period ticks.
+ * If the timer is already armed, it is re-armed.
+ */
+void timer_arm_periodic(struct timer *timer, u32_t period)
+{
+	bool iflag;
+
+	KASSERT(period > 0);
+
+	iflag = int_begin_atomic();
+
+	timer_cancel(timer);
+	timer->expires = g_numticks + period;
+	timer->period = period;
+	timer_enqueue(timer);
+
+	int_end_atomic(iflag);
+}
+
+/*
+ * Disarm a timer.
+ * Returns true if the timer was armed.
+ */
+bool timer_cancel(struct timer *timer)
+{
+	bool iflag, armed;
+
+	iflag = int_begin_atomic();
+
+	armed = (timer->bucket != 0);
+	if (armed) {
+		timer_list_remove(timer->bucket, timer);
+		timer->bucket = 0;
+	}
+	timer->period = 0;
+
+	int_end_atomic(iflag);
+
+	return armed;
+}
+
+/*
+ * Return true if given timer is armed.
+ */
+bool timer_is_armed(struct timer *timer)
+{
+	return timer->bucket != 0;
 }
@@ -22,30 +22,73 @@
 #include <geekos/errno.h>
 #include <geekos/string.h>
 #include <geekos/mem.h>
+#include <geekos/rcu.h>
+#include <geekos/atomic.h>
+#include <geekos/vm.h>
+#include <geekos/range.h>
+#include <geekos/workqueue.h>
 
 /*
  * VFS locking and refcounting rules:
  *
- * - s_fs_mutex must be held while navigating the tree.
+ * - Path walks are lockless where the dentry cache can answer:
+ *   each step is a hash probe inside rcu_read_lock().  Dentries are
+ *   freed with call_rcu(), so a walker never sees a freed dentry.
  *
- * - A directory inode is marked as busy while performing
- *   a lookup or other operation that depends upon or changes
- *   the tree structure.
+ * - Each directory inode has a mutex, held while a lookup which
+ *   missed the dentry cache searches its child list or calls into
+ *   the filesystem, and while adding to its child list.  Only walks
+ *   which need that particular directory populated wait for it.
  *
- * - s_fs_mutex is unlocked when performing a potentially long-running
- *   I/O operation on a directory inode; re-acquired when finished.
- *   This is safe because the inode is marked as busy, so any
- *   concurrent vfs calls will be blocked if they reach the inode
- *   and try to do something.
+ * - s_dcache_lock serializes changes to the dentry cache (hash chains,
+ *   LRU list, per-directory lists and count).  Entries are only added
+ *   by vfs_lookup_child() with the parent's mutex held, so there is at
+ *   most one entry per (parent, name) naming a live inode.  The dentry
+ *   cache also remembers names which the filesystem reported as not
+ *   existing (negative entries).  Positive entries may be evicted at
+ *   any time, since the child lists still hold the inodes.
  *
- * - An inode's refcount is the number of threads holding an
- *   active reference to the inode, or any tree descendent of the inode.
- *   In other words, if a thread holds a reference to an inode,
- *   it has incremented the refcount of the inode and all of
- *   the inode's tree ancestors back to the root directory.
+ * - s_mount_mutex serializes mounting, and protects s_inst_list
+ *   and the inodes' mount fields.
  *
- * - Acquisition order: s_fs_mutex is acquired before
- *   s_driver_list_mutex if both are to be held simultaneously.
+ * - An inode's refcount is the number of active references to the
+ *   inode, plus the number of its children whose refcount is nonzero:
+ *   an inode's first reference pins its parent, and its last unpins
+ *   it.  So while a thread holds a reference to an inode, the inode
+ *   and all of its tree ancestors have nonzero refcounts, but taking
+ *   or dropping a reference usually touches only the inode itself.
+ *   Refcounts, the unused inode LRU and the inode counts are
+ *   protected by disabling interrupts, so references can be taken
+ *   inside rcu_read_lock().
+ *
+ * - Inodes whose refcount is 0 are kept on the unused inode LRU.
+ *   When more than s_inode_cache_max inodes are in memory, or a
+ *   memory allocation fails, s_inode_shrink_work evicts unused
+ *   leaf inodes, least recently used first, skipping those whose
+ *   parent's mutex is held.  With the parent's mutex held, an inode
+ *   is marked as evicting (so no new references can be taken), its
+ *   data is written back, and it is removed from its parent's child
+ *   list and from the dentry cache.  Then its filesystem close
+ *   operation is called, and it is freed after a grace period.
+ *
+ * - Filesystems return inodes from lookup and get_root with one
+ *   reference, which has not pinned the parent.
+ *
+ * - File data is read and written through each file inode's
+ *   vm_pagecache, whose pager calls the inode's read_page and
+ *   write_page operations.  A file inode's mutex protects its size.
+ *   The driver sets the size when it creates the inode; vfs_write()
+ *   extends it in memory, and vfs_close() and eviction record it on
+ *   disk through the optional write_size operation.  Pages at or past
+ *   the size recorded on disk (disk_size) are never read from the
+ *   filesystem: they start out zero-filled.
+ *
+ * - Acquisition order: a directory's mutex, then s_dcache_lock.
+ *   The evictor locks an inode's parent, which is safe because
+ *   an inode on a child list keeps its parent from being evicted.
+ *   It only ever trylocks it, so it never waits for a lookup.
+ *   s_mount_mutex is acquired before s_driver_list_lock if both
+ *   are to be held simultaneously.
  */
 
 /* ---------- Private Implementation ---------- */
@@ -53,26 +96,89 @@
 IMPLEMENT_LIST_GET_FIRST(inode_list, inode)
 IMPLEMENT_LIST_NEXT(inode_list, inode)
 IMPLEMENT_LIST_APPEND(inode_list, inode)
+IMPLEMENT_LIST_REMOVE(inode_list, inode)
+IMPLEMENT_LIST_IS_EMPTY(inode_list, inode)
+
+IMPLEMENT_LIST_PREPEND(inode_lru_list, inode)
+IMPLEMENT_LIST_REMOVE(inode_lru_list, inode)
+IMPLEMENT_LIST_GET_LAST(inode_lru_list, inode)
+IMPLEMENT_LIST_PREV(inode_lru_list, inode)
 
 IMPLEMENT_LIST_APPEND(fs_instance_list, fs_instance)
 
+/*
+ * Dentry cache entry: maps a name in a directory to the child inode,
+ * or to nothing (inode == 0) if the name does not exist.
+ */
+DECLARE_LIST(dentry_hash_list, dentry);
+DECLARE_LIST(dentry_lru_list, dentry);
+
+struct dentry {
+	struct inode *parent;         /* directory containing the name */
+	struct inode *inode;          /* named inode, or null for a negative entry */
+	u32_t name_hash;              /* vfs_name_hash() of name */
+	bool referenced;              /* used since last considered for eviction */
+	struct rcu_head rcu;          /* for freeing after readers are done */
+	DEFINE_LINK(dentry_hash_list, dentry);
+	DEFINE_LINK(dentry_lru_list, dentry);
+	DEFINE_LINK(dentry_dir_list, dentry);
+	char name[1];                 /* name, allocated along with the dentry */
+};
+
+IMPLEMENT_LIST_PREPEND_RCU(dentry_hash_list, dentry)
+IMPLEMENT_LIST_REMOVE_RCU(dentry_hash_list, dentry)
+IMPLEMENT_LIST_GET_FIRST_RCU(dentry_hash_list, dentry)
+IMPLEMENT_LIST_NEXT_RCU(dentry_hash_list, dentry)
+
+IMPLEMENT_LIST_PREPEND(dentry_lru_list, dentry)
+IMPLEMENT_LIST_REMOVE(dentry_lru_list, dentry)
+IMPLEMENT_LIST_GET_LAST(dentry_lru_list, dentry)
+
+IMPLEMENT_LIST_PREPEND(dentry_dir_list, dentry)
+IMPLEMENT_LIST_REMOVE(dentry_dir_list, dentry)
+IMPLEMENT_LIST_GET_FIRST(dentry_dir_list, dentry)
+IMPLEMENT_LIST_NEXT(dentry_dir_list, dentry)
+
+#define VFS_DCACHE_HASH_BITS 8
+#define VFS_DCACHE_BUCKETS   (1 << VFS_DCACHE_HASH_BITS)
+#define VFS_DCACHE_MAX       512  /* entries kept before trimming */
+
+#define VFS_INODE_CACHE_MAX  256  /* default for s_inode_cache_max */
+
 /* filesystem driver list */
-struct mutex s_driver_list_mutex;    /* protects changes/access to fs driver list */
+struct rwlock s_driver_list_lock;    /* protects changes/access to fs driver list */
 struct fs_driver *s_driver_list;     /* list of filesystem drivers */
 
 /* filesystem data structures */
-struct mutex s_fs_mutex;             /* protects changes/access to the tree structure */
+struct mutex s_mount_mutex;          /* serializes mounting */
 struct fs_instance *s_root_instance; /* root filesystem instance */
 struct inode *s_root_dir;            /* root directory */
 struct fs_instance_list s_inst_list; /* list of all mounted fs_instances */
 
+/* dentry cache */
+static struct mutex s_dcache_lock;   /* serializes dentry cache updates */
+static struct dentry_hash_list s_dcache[VFS_DCACHE_BUCKETS];
+static struct dentry_lru_list s_dcache_lru; /* most recently used first */
+static int s_dcache_count;
+
+/* inode cache */
+static struct inode_lru_list s_inode_lru;  /* unused inodes, most recently used first */
+static int s_num_inodes;
+static int s_num_unused;
+static int s_inode_cache_max = VFS_INODE_CACHE_MAX;
+static int s_inode_shrink_request;         /* inodes the shrinker asked us to evict */
+static struct work s_inode_shrink_work;
+static volatile int s_inode_hits, s_inode_misses, s_inode_evictions;
+
 /*
- * Adjust the refcount of given inode and all of its tree ancestors
- * by given delta.
+ * Add a reference to given inode, unless it is being evicted.
+ * The first reference to an inode also pins its parent, so taking
+ * a reference is O(1) unless the inode was unreferenced.
+ * Returns true if successful.
  */
-static void vfs_adjust_refcounts(struct inode *inode, int delta)
+static bool vfs_tryget_ref(struct inode *inode)
 {
-	KASSERT(MUTEX_IS_HELD(&s_fs_mutex));
+	bool iflag, live;
 
 	/*
 	 * FIXME: how should this operation work when it
@@ -80,13 +186,413 @@ static void vfs_adjust_refcounts(struct inode *inode, int delta)
 	 *        need to think about.
 	 */
 
+	iflag = int_begin_atomic();
+	live = !inode->evicting;
+	if (live) {
+		for (; inode != 0 && inode->refcount++ == 0; inode = inode->parent) {
+			/* first reference: no longer unused */
+			inode_lru_list_remove(&s_inode_lru, inode);
+			s_num_unused--;
+		}
+	}
+	int_end_atomic(iflag);
+
+	return live;
+}
+
+/*
+ * Add a reference to an inode which cannot be being evicted,
+ * because the caller holds a reference to it or one of its children.
+ */
+static void vfs_get_ref(struct inode *inode)
+{
+	bool live = vfs_tryget_ref(inode);
+	KASSERT(live);
+}
+
+/*
+ * Drop a reference to given inode.  Dropping the last reference
+ * puts the inode on the unused LRU, and unpins its parent.
+ */
+static void vfs_put_ref(struct inode *inode)
+{
+	bool iflag, over_limit;
+
+	iflag = int_begin_atomic();
 	for (; inode != 0; inode = inode->parent) {
-		KASSERT(inode->refcount >= 0);
-		KASSERT(delta > 0 || inode->refcount > 0);
-		inode->refcount += delta;
+		KASSERT(inode->refcount > 0);
+		if (--inode->refcount > 0) {
+			break;
+		}
+		inode_lru_list_prepend(&s_inode_lru, inode);
+		s_num_unused++;
+	}
+	over_limit = s_num_inodes > s_inode_cache_max && s_num_unused > 0;
+	int_end_atomic(iflag);
+
+	if (over_limit) {
+		workqueue_queue_work(g_system_wq, &s_inode_shrink_work);
+	}
+}
+
+/*
+ * Hash a file name (FNV-1a).
+ */
+static u32_t vfs_name_hash(const char *name)
+{
+	u32_t hash = 2166136261U;
+
+	while (*name != '\0') {
+		hash = (hash ^ (u8_t) *name++) * 16777619U;
+	}
+	return hash;
+}
+
+/*
+ * Get the dentry cache bucket for given name in given directory.
+ */
+static struct dentry_hash_list *vfs_dcache_bucket(struct inode *parent, u32_t name_hash)
+{
+	u32_t hash = (name_hash ^ (u32_t) (ulong_t) parent) * 0x9e3779b1U;
+	return &s_dcache[hash >> (32 - VFS_DCACHE_HASH_BITS)];
+}
+
+/*
+ * Find the dentry for given name in given directory,
+ * marking it as recently used.
+ * Must be called inside rcu_read_lock().
+ * Returns null if the name is not cached.
+ */
+static struct dentry *vfs_dcache_lookup(struct inode *parent, const char *name, u32_t name_hash)
+{
+	struct dentry *dentry;
+
+	KASSERT(!preemptible());
+
+	for (dentry = dentry_hash_list_get_first_rcu(vfs_dcache_bucket(parent, name_hash));
+	     dentry != 0;
+	     dentry = dentry_hash_list_next_rcu(dentry)) {
+		if (dentry->parent == parent && dentry->name_hash == name_hash &&
+		    strncmp(dentry->name, name, VFS_NAMELEN_MAX) == 0) {
+			/* no lock for the LRU list here: the evictor gives it a second chance */
+			dentry->referenced = true;
+			return dentry;
+		}
 	}
+	return 0;
+}
+
+static void vfs_dcache_free(struct rcu_head *head)
+{
+	mem_free((char *) head - offsetof(struct dentry, rcu));
+}
+
+/*
+ * Remove a dentry from the cache, and free it after a grace period.
+ * s_dcache_lock must be held.
+ */
+static void vfs_dcache_remove(struct dentry *dentry)
+{
+	KASSERT(MUTEX_IS_HELD(&s_dcache_lock));
+
+	dentry_hash_list_remove_rcu(vfs_dcache_bucket(dentry->parent, dentry->name_hash), dentry);
+	dentry_lru_list_remove(&s_dcache_lru, dentry);
+	dentry_dir_list_remove(&dentry->parent->dentries, dentry);
+	s_dcache_count--;
+	call_rcu(&dentry->rcu, &vfs_dcache_free);
 }
 
+/*
+ * Evict the least recently used dentry, skipping (and clearing)
+ * dentries used since they were last considered.
+ * s_dcache_lock must be held.
+ */
+static void vfs_dcache_evict_lru(void)
+{
+	struct dentry *dentry;
+
+	KASSERT(MUTEX_IS_HELD(&s_dcache_lock));
+
+	while ((dentry = dentry_lru_list_get_last(&s_dcache_lru))->referenced) {
+		dentry->referenced = false;
+		dentry_lru_list_remove(&s_dcache_lru, dentry);
+		dentry_lru_list_prepend(&s_dcache_lru, dentry);
+	}
+
+	vfs_dcache_remove(dentry);
+}
+
+/*
+ * Remove the dentries in given directory inode, and the dentries
+ * naming it, from the cache.  The inode's parent must be locked.
+ */
+static void vfs_dcache_purge(struct inode *inode)
+{
+	struct dentry *dentry, *next;
+
+	KASSERT(MUTEX_IS_HELD(&inode->parent->lock));
+
+	mutex_lock(&s_dcache_lock);
+
+	while ((dentry = dentry_dir_list_get_first(&inode->dentries)) != 0) {
+		vfs_dcache_remove(dentry);
+	}
+
+	for (dentry = dentry_dir_list_get_first(&inode->parent->dentries); dentry != 0; dentry = next) {
+		next = dentry_dir_list_next(dentry);
+		if (dentry->inode == inode) {
+			vfs_dcache_remove(dentry);
+		}
+	}
+
+	mutex_unlock(&s_dcache_lock);
+}
+
+/*
+ * Add a dentry mapping given name in given directory to given
+ * inode (null for a negative entry), evicting the least recently
+ * used entry if the cache is full.
+ */
+static void vfs_dcache_insert(struct inode *parent, const char *name, u32_t name_hash, struct inode *inode)
+{
+	struct dentry *dentry;
+	size_t namelen = strlen(name);
+
+	KASSERT(MUTEX_IS_HELD(&parent->lock));
+
+	dentry = mem_alloc(sizeof(struct dentry) + namelen);
+	dentry->parent = parent;
+	dentry->inode = inode;
+	dentry->name_hash = name_hash;
+	dentry->referenced = false;
+	memcpy(dentry->name, name, namelen + 1);
+
+	mutex_lock(&s_dcache_lock);
+
+	if (s_dcache_count >= VFS_DCACHE_MAX) {
+		vfs_dcache_evict_lru();
+	}
+
+	dentry_hash_list_prepend_rcu(vfs_dcache_bucket(parent, name_hash), dentry);
+	dentry_lru_list_prepend(&s_dcache_lru, dentry);
+	dentry_dir_list_prepend(&parent->dentries, dentry);
+	s_dcache_count++;
+
+	mutex_unlock(&s_dcache_lock);
+}
+
+/*
+ * Look up given name in the dentry cache and, if found, add a
+ * reference to the child.  Returns true if the name was cached,
+ * with *p_rc set to 0 (child stored in *p_inode) or EEXIST.
+ * A child which is being evicted counts as not cached.
+ */
+static bool vfs_dcache_get(struct inode *parent, const char *name, u32_t name_hash,
+	struct inode **p_inode, int *p_rc)
+{
+	struct dentry *dentry;
+	bool found;
+
+	rcu_read_lock();
+	dentry = vfs_dcache_lookup(parent, name, name_hash);
+	found = dentry != 0;
+	if (found) {
+		*p_inode = dentry->inode;
+		if (dentry->inode == 0) {
+			*p_rc = EEXIST;
+		} else if (vfs_tryget_ref(dentry->inode)) {
+			*p_rc = 0;
+		} else {
+			found = false;
+		}
+	}
+	rcu_read_unlock();
+
+	if (found) {
+		atomic_inc(&s_inode_hits);
+	}
+	return found;
+}
+
+/*
+ * Write back a file's modified data, and its size if it was extended.
+ * Returns 0 if successful, or an error code.
+ */
+static int vfs_sync_inode(struct inode *inode)
+{
+	int rc;
+
+	KASSERT(inode->type == VFS_FILE);
+
+	rc = vm_pagecache_sync(inode->pagecache);
+
+	mutex_lock(&inode->lock);
+	if (rc == 0 && inode->size_dirty && inode->ops->write_size != 0) {
+		rc = inode->ops->write_size(inode, inode->size);
+		if (rc == 0) {
+			inode->size_dirty = false;
+			inode->disk_size = inode->size;
+		}
+	}
+	mutex_unlock(&inode->lock);
+
+	return rc;
+}
+
+static void vfs_inode_free(struct rcu_head *head)
+{
+	mem_free((char *) head - offsetof(struct inode, rcu));
+}
+
+/*
+ * Take the least recently used unused inode which can be evicted
+ * off the LRU, lock its parent, and mark it as evicting so that no
+ * new references can be taken.  Only leaves which are not filesystem
+ * roots or mountpoints can be evicted.  Inodes whose parent's mutex
+ * is held are skipped: its holder may be waiting for memory, which
+ * would deadlock the evictor.  Returns null if there is none.
+ */
+static struct inode *vfs_inode_lru_claim(void)
+{
+	struct inode *inode;
+	bool iflag = int_begin_atomic();
+
+	for (inode = inode_lru_list_get_last(&s_inode_lru);
+	     inode != 0;
+	     inode = inode_lru_list_prev(inode)) {
+		/* children can only be added by a thread holding a reference */
+		if (inode->parent != 0 && inode->mount == 0 &&
+		    inode_list_is_empty(&inode->child_list) &&
+		    mutex_trylock(&inode->parent->lock)) {
+			inode_lru_list_remove(&s_inode_lru, inode);
+			s_num_unused--;
+			inode->evicting = true;
+			break;
+		}
+	}
+
+	int_end_atomic(iflag);
+	return inode;
+}
+
+/*
+ * Evict one unused inode.
+ * Returns true if an inode was evicted.
+ */
+static bool vfs_inode_evict(void)
+{
+	struct inode *inode, *parent;
+	struct vm_pager *pager;
+	bool iflag;
+
+	inode = vfs_inode_lru_claim();
+	if (inode == 0) {
+		return false;
+	}
+
+	/*
+	 * The parent's mutex is held until the inode is off the child
+	 * list: a lookup of the same name waits for it, rather than
+	 * reading the file back from the filesystem before it is
+	 * written back.
+	 */
+	parent = inode->parent;
+
+	/* write back modified data; if that fails, keep the inode */
+	if (inode->type == VFS_FILE && vfs_sync_inode(inode) != 0) {
+		iflag = int_begin_atomic();
+		inode->evicting = false;
+		inode_lru_list_prepend(&s_inode_lru, inode);
+		s_num_unused++;
+		int_end_atomic(iflag);
+		mutex_unlock(&parent->lock);
+		return false;
+	}
+
+	/* remove it from the tree */
+	inode_list_remove(&parent->child_list, inode);
+	vfs_dcache_purge(inode);
+	mutex_unlock(&parent->lock);
+
+	/* let the filesystem free its data, then free ours */
+	inode->ops->close(inode);
+	if (inode->pagecache != 0) {
+		pager = inode->pagecache->pager;
+		vm_pagecache_destroy(inode->pagecache);
+		mem_free(pager);
+	}
+
+	iflag = int_begin_atomic();
+	s_num_inodes--;
+	int_end_atomic(iflag);
+	atomic_inc(&s_inode_evictions);
+
+	/* lockless lookups may still be looking at the inode */
+	call_rcu(&inode->rcu, &vfs_inode_free);
+	return true;
+}
+
+/*
+ * Workqueue callback: evict unused inodes until the number of
+ * inodes is within the limit, and as many as the shrinker asked for.
+ */
+static void vfs_inode_shrink_work(void *unused)
+{
+	int nr_requested;
+	bool iflag;
+
+	iflag = int_begin_atomic();
+	nr_requested = s_inode_shrink_request;
+	s_inode_shrink_request = 0;
+	int_end_atomic(iflag);
+
+	while ((nr_requested > 0 || s_num_inodes > s_inode_cache_max) && vfs_inode_evict()) {
+		nr_requested--;
+	}
+}
+
+/*
+ * Shrinker for the inode cache.  Evicting an inode may block,
+ * so the work is handed to s_inode_shrink_work; the memory is
+ * freed (waking up the allocating thread) after it runs.
+ */
+static int vfs_inode_cache_shrink(struct mem_shrinker *shrinker, int nr_to_free)
+{
+	KASSERT(!int_enabled());
+
+	if (s_num_unused > 0) {
+		s_inode_shrink_request += nr_to_free;
+		workqueue_queue_work(g_system_wq, &s_inode_shrink_work);
+	}
+	return 0;
+}
+
+static struct mem_shrinker s_inode_cache_shrinker = {
+	.name = "inode cache",
+	.shrink = &vfs_inode_cache_shrink,
+};
+
+/*
+ * Pager for a file's vm_pagecache: transfers pages using
+ * the file inode's operations.
+ */
+static int vfs_pager_read_page(struct vm_pager *pager, void *buf, u32_t page_num)
+{
+	struct inode *inode = pager->p;
+	return inode->ops->read_page(inode, buf, page_num);
+}
+
+static int vfs_pager_write_page(struct vm_pager *pager, void *buf, u32_t page_num)
+{
+	struct inode *inode = pager->p;
+	return inode->ops->write_page(inode, buf, page_num);
+}
+
+static struct vm_pager_ops s_vfs_pager_ops = {
+	.read_page = &vfs_pager_read_page,
+	.write_page = &vfs_pager_write_page,
+};
+
 /*
  * Find an fs_driver.
  */
@@ -94,7 +600,7 @@ int vfs_find_fs_driver(const char *name, struct fs_driver **p_driver)
 {
 	struct fs_driver *fs_driver;
 
-	mutex_lock(&s_driver_list_mutex);
+	rwlock_read_lock(&s_driver_list_lock);
 
 	for (fs_driver = s_driver_list; fs_driver != 0; fs_driver = fs_driver->next) {
 		if (strcmp(name, fs_driver->ops->get_name(fs_driver)) == 0) {
@@ -102,7 +608,7 @@ int vfs_find_fs_driver(const char *name, struct fs_driver **p_driver)
 		}
 	}
 
-	mutex_unlock(&s_driver_list_mutex);
+	rwlock_read_unlock(&s_driver_list_lock);
 
 	if (fs_driver != 0) {
 		*p_driver = fs_driver;
@@ -126,7 +632,7 @@ int vfs_do_mount(const char *fs_driver_name,
 	struct fs_instance *fs_inst = 0;
 	struct inode *root_dir = 0;
 
-	KASSERT(MUTEX_IS_HELD(&s_fs_mutex));
+	KASSERT(MUTEX_IS_HELD(&s_mount_mutex));
 	KASSERT(mountpoint == 0 || (mountpoint->type == VFS_DIR && mountpoint->mount == 0));
 
 	/* if mounting root,
@@ -181,12 +687,12 @@ static bool vfs_has_more_path_elements(const char *path)
 
 /*
  * Copy the next path element in given path buffer
- * into given name buffer.
+ * into given name buffer, and store its hash in *p_hash.
  * If successful, *p_path is updated to point to the beginning
  * of the remaining path components, and 0 is returned.
  * Otherwise, an error code is returned.
  */
-static int vfs_get_next_path_element(const char **p_path, char *namebuf)
+static int vfs_get_next_path_element(const char **p_path, char *namebuf, u32_t *p_hash)
 {
 	size_t namelen = 0;
 	const char *p = *p_path;
@@ -207,6 +713,7 @@ static int vfs_get_next_path_element(const char **p_path, char *namebuf)
 	memcpy(namebuf, *p_path, namelen);
 	namebuf[namelen] = '\0';
 	KASSERT(strnlen(namebuf, VFS_NAMELEN_MAX + 1) <= VFS_NAMELEN_MAX);
+	*p_hash = vfs_name_hash(namebuf);
 
 	/* skip over any path separators */
 	while (*p == '/') {
@@ -221,82 +728,119 @@ static int vfs_get_next_path_element(const char **p_path, char *namebuf)
 }
 
 /*
- * Search for named child in given directory.
- * The dir inode must be locked.
+ * Search for named child in given directory, and add a reference
+ * to it.
+ * The dir's mutex must be held.
  * If sucessful, stores pointer to named child in p_inode and
  * returns 0.  Otherwise, returns error code.
+ * The result is added to the dentry cache; if the filesystem
+ * reports that the child does not exist (EEXIST), a negative
+ * entry is added.
  */
-int vfs_lookup_child(struct inode *dir, const char *name, struct inode **p_inode)
+int vfs_lookup_child(struct inode *dir, const char *name, u32_t name_hash, struct inode **p_inode)
 {
 	int rc = 0;
 	struct inode *child;
 
-	KASSERT(MUTEX_IS_HELD(&s_fs_mutex));
+	KASSERT(MUTEX_IS_HELD(&dir->lock));
 	KASSERT(dir->type == VFS_DIR);
-	KASSERT(dir->busy);
 
-	/* first, see if the child is already part of the dir's child list */
+	/* another thread may have looked up the child while we waited for the dir */
+	if (vfs_dcache_get(dir, name, name_hash, p_inode, &rc)) {
+		return rc;
+	}
+
+	/* see if the child is already part of the dir's child list */
 	for (child = inode_list_get_first(&dir->child_list);
 	     child != 0;
 	     child = inode_list_next(child)) {
-		if (strncmp(name, dir->name, VFS_NAMELEN_MAX) == 0) {
+		if (child->name_hash == name_hash &&
+		    strncmp(name, child->name, VFS_NAMELEN_MAX) == 0 &&
+		    vfs_tryget_ref(child)) {
+			atomic_inc(&s_inode_hits);
 			*p_inode = child;
 			goto done;
 		}
 	}
 
-	/* release fs mutex while search is in progress */
-	mutex_unlock(&s_fs_mutex);
-
-	/* look up child from filesystem */
+	/*
+	 * Look up child from filesystem.  Only this directory's
+	 * mutex is held while the search is in progress.
+	 */
 	rc = dir->ops->lookup(dir, name, p_inode);
+	atomic_inc(&s_inode_misses);
 
-	/* if lookup succeeded, add to dir's child list */
+	/*
+	 * If lookup succeeded, add to dir's child list.  Our reference
+	 * is the one the filesystem returned, so pin the dir for it.
+	 */
 	if (rc == 0) {
 		inode_list_append(&dir->child_list, *p_inode);
+		vfs_get_ref(dir);
 	}
 
-	/* re-acquire the fs mutex */
-	mutex_lock(&s_fs_mutex);
-
 done:
+	if (rc == 0) {
+		vfs_dcache_insert(dir, name, name_hash, *p_inode);
+	} else if (rc == EEXIST) {
+		vfs_dcache_insert(dir, name, name_hash, 0);
+	}
 	return rc;
 }
 
+/* ---------- Public Interface ---------- */
+
 /*
- * Lock a directory in preparation for a lookup.
- * fs mutex must be held.
+ * Initialize the VFS.
  */
-static void vfs_lock_dir(struct inode *dir)
+void vfs_init(void)
 {
-	KASSERT(MUTEX_IS_HELD(&s_fs_mutex));
-	while (dir->busy) {
-		cond_wait(&dir->inode_cond, &s_fs_mutex);
-	}
-	dir->busy = true;
+	work_init(&s_inode_shrink_work, &vfs_inode_shrink_work, 0);
+	mem_register_shrinker(&s_inode_cache_shrinker);
 }
 
 /*
- * Unlock a directory after completing a lookup.
- * fs mutex must be held.
+ * Set the number of inodes kept in memory before unused
+ * inodes are evicted.
  */
-static void vfs_unlock_dir(struct inode *dir)
+void vfs_set_inode_cache_max(int max_inodes)
 {
-	KASSERT(MUTEX_IS_HELD(&s_fs_mutex));
-	KASSERT(dir->busy);
-	dir->busy = false;
-	cond_broadcast(&dir->inode_cond);
+	KASSERT(max_inodes > 0);
+
+	s_inode_cache_max = max_inodes;
+	if (s_num_inodes > s_inode_cache_max) {
+		workqueue_queue_work(g_system_wq, &s_inode_shrink_work);
+	}
 }
 
-/* ---------- Public Interface ---------- */
+/*
+ * Get inode cache statistics.
+ */
+void vfs_get_inode_cache_stats(struct vfs_inode_cache_stats *stats)
+{
+	bool iflag = int_begin_atomic();
+
+	stats->num_inodes = s_num_inodes;
+	stats->num_unused = s_num_unused;
+	stats->max_inodes = s_inode_cache_max;
+	stats->hits = s_inode_hits;
+	stats->misses = s_inode_misses;
+	stats->evictions = s_inode_evictions;
+
+	int_end_atomic(iflag);
+}
 
 int vfs_mount_root(const char *fs_driver_name, const char *init, const char *opts)
 {
 	int rc;
+	struct inode *root_dir = 0;
 
-	mutex_lock(&s_fs_mutex);
-	rc = vfs_do_mount(fs_driver_name, 0, init, opts, &s_root_dir);
-	mutex_unlock(&s_fs_mutex);
+	mutex_lock(&s_mount_mutex);
+	rc = vfs_do_mount(fs_driver_name, 0, init, opts, &root_dir);
+	if (rc == 0) {
+		rcu_assign_pointer(s_root_dir, root_dir);
+	}
+	mutex_unlock(&s_mount_mutex);
 
 	return rc;
 }
@@ -332,7 +876,7 @@ int vfs_mount(const char *path, const char *fs_driver_name, const char *init, co
 	}
 
 	/* now we can attempt to mount the filesystem. */
-	mutex_lock(&s_fs_mutex);
+	mutex_lock(&s_mount_mutex);
 	rc = vfs_do_mount(fs_driver_name, 0, init, opts, &mount_root_dir);
 	if (rc == 0) {
 		/* success */
@@ -343,12 +887,11 @@ int vfs_mount(const char *path, const char *fs_driver_name, const char *init, co
 		mount_root_dir->parent = mountpoint->parent;
 
 		/* the mounted root directory adds a ref to the directory
-		 * it's mounted on, as well as the directories back to
-		 * the overall root directory */
-		vfs_adjust_refcounts(mountpoint, 1);
+		 * it's mounted on, which keeps it in the tree */
+		vfs_get_ref(mountpoint);
 	}
 
-	mutex_unlock(&s_fs_mutex);
+	mutex_unlock(&s_mount_mutex);
 
 done:
 	vfs_release_ref(mountpoint);
@@ -363,24 +906,18 @@ done:
  */
 int vfs_get_root_dir(struct inode **p_dir)
 {
-	int rc = 0;
-
-	mutex_lock(&s_fs_mutex);
+	struct inode *root_dir = rcu_dereference(s_root_dir);
 
 	/* return EEXIST if root filesystem hasn't been mounted yet */
-	if (!s_root_dir) {
-		rc = EEXIST;
-		goto done;
+	if (root_dir == 0) {
+		return EEXIST;
 	}
 
 	/* return ptr to root dir in p_dir and add a reference */
-	*p_dir = s_root_dir;
-	(*p_dir)->refcount++;
-
-done:
-	mutex_lock(&s_fs_mutex);
+	vfs_get_ref(root_dir);
+	*p_dir = root_dir;
 
-	return rc;
+	return 0;
 }
 
 /*
@@ -394,6 +931,7 @@ int vfs_lookup_inode(struct inode *start_dir, const char *path, struct inode **p
 	int rc = 0;
 	struct inode *inode = start_dir, *child;
 	char *name = 0;
+	u32_t name_hash;
 
 	KASSERT(*path != '/'); /* must be a relative path! */
 	KASSERT(start_dir->refcount > 0);
@@ -406,14 +944,12 @@ int vfs_lookup_inode(struct inode *start_dir, const char *path, struct inode **p
 	/* allocate a name buffer */
 	name = mem_alloc(VFS_NAMELEN_MAX + 1);
 
-	mutex_lock(&s_fs_mutex);
-
-	/* increment the refcount of start inode and each tree ancestor */
-	vfs_adjust_refcounts(start_dir, 1);
+	/* add a reference to the start inode, to be traded for a reference to each child in turn */
+	vfs_get_ref(start_dir);
 
 	while (vfs_has_more_path_elements(path)) {
 		/* extract one path element */
-		if ((rc = vfs_get_next_path_element(&path, name)) != 0) {
+		if ((rc = vfs_get_next_path_element(&path, name, &name_hash)) != 0) {
 			goto done;
 		}
 
@@ -428,23 +964,21 @@ int vfs_lookup_inode(struct inode *start_dir, const char *path, struct inode **p
 			goto done;
 		}
 
-		/* lock dir */
-		vfs_lock_dir(inode);
-
-		/* look up child */
-		rc = vfs_lookup_child(inode, name, &child);
-
-		/* unlock dir */
-		vfs_unlock_dir(inode);
+		/* look up child: if it is cached, no need to lock dir */
+		if (!vfs_dcache_get(inode, name, name_hash, &child, &rc)) {
+			mutex_lock(&inode->lock);
+			rc = vfs_lookup_child(inode, name, name_hash, &child);
+			mutex_unlock(&inode->lock);
+		}
 
 		if (rc != 0) {
 			/* child not found */
 			goto done;
 		}
 
-		/* continue search in child */
+		/* continue search in child: its reference keeps the dir pinned */
+		vfs_put_ref(inode);
 		inode = child;
-		inode->refcount++;
 	}
 
 	/* success: the path is empty and we have located the named inode */
@@ -455,13 +989,10 @@ int vfs_lookup_inode(struct inode *start_dir, const char *path, struct inode **p
 
 done:
 	if (rc != 0) {
-		/* failed search: decrement refcounts of current inode
-		 * and all tree ancestors */
-		vfs_adjust_refcounts(inode, -1);
+		/* failed search: drop the reference to the current inode */
+		vfs_put_ref(inode);
 	}
 
-	mutex_unlock(&s_fs_mutex);
-
 	mem_free(name);
 
 	return rc;
@@ -477,38 +1008,199 @@ void vfs_release_ref(struct inode *inode)
 		return;
 	}
 
-	mutex_lock(&s_fs_mutex);
-
 	KASSERT(inode->refcount > 0);
 
-	/* decremenent refcounts of inode and all tree ancestors */
-	vfs_adjust_refcounts(inode, -1);
+	/* drop the reference, unpinning the parent if it was the last */
+	vfs_put_ref(inode);
 
 	/*
-	 * Note: we allow the refcount of a inode to reach 0.
-	 * It will be removed from the tree only if the
-	 * underlying filesystem file is deleted.
+	 * Note: an inode whose refcount reaches 0 stays in the tree,
+	 * on the unused inode LRU, so later lookups can find it.
+	 * It is evicted (least recently used first) when the inode
+	 * cache exceeds its limit or memory runs low.
 	 */
+}
+
+/*
+ * Lock a page of a file whose current contents are needed.
+ * Pages at or past the size recorded on disk have no data there,
+ * so they start out zero-filled instead of being read in.
+ */
+static int vfs_lock_file_page(struct inode *inode, u32_t page_num, struct frame **p_frame)
+{
+	if (((ulong_t) page_num << PAGE_POWER) >= inode->disk_size) {
+		return vm_lock_new_page(inode->pagecache, page_num, p_frame);
+	}
+	return vm_lock_page(inode->pagecache, page_num, p_frame);
+}
+
+/*
+ * Zero the part of a file's last page past the end of the file,
+ * before the file is extended: it may hold whatever followed the
+ * file's data on disk.  The inode's mutex must be held.
+ */
+static int vfs_zero_eof_page(struct inode *inode)
+{
+	int rc;
+	size_t page_offset = inode->size & ~PAGE_MASK;
+	struct frame *frame;
+
+	KASSERT(MUTEX_IS_HELD(&inode->lock));
+
+	if (page_offset == 0) {
+		return 0;
+	}
+
+	rc = vfs_lock_file_page(inode, inode->size >> PAGE_POWER, &frame);
+	if (rc != 0) {
+		return rc;
+	}
+	memset((u8_t *) mem_frame_to_pa(frame) + page_offset, 0, PAGE_SIZE - page_offset);
+	vm_set_page_dirty(inode->pagecache, frame);
+	vm_unlock_page(inode->pagecache, frame);
 
-	mutex_unlock(&s_fs_mutex);
+	return 0;
 }
 
-int vfs_read(struct inode *inode, void *buf, size_t len)
+/*
+ * Read up to len bytes from given file, starting at given offset.
+ * Returns the number of bytes read (0 at end of file),
+ * or an error code if no bytes could be read.
+ */
+int vfs_read(struct inode *inode, void *buf, size_t len, ulong_t offset)
 {
-	/* TODO */
-	return -1;
+	int rc = 0;
+	size_t nread = 0, chunk, page_offset;
+	ulong_t size = inode->size;
+	struct frame *frame;
+
+	if (inode->type != VFS_FILE) {
+		return EINVAL;
+	}
+
+	/* don't read past end of file */
+	if (offset >= size) {
+		return 0;
+	}
+	len = range_umin(len, size - offset);
+
+	while (nread < len) {
+		page_offset = offset & ~PAGE_MASK;
+		chunk = range_umin(PAGE_SIZE - page_offset, len - nread);
+
+		rc = vfs_lock_file_page(inode, offset >> PAGE_POWER, &frame);
+		if (rc != 0) {
+			break;
+		}
+		memcpy((u8_t *) buf + nread, (u8_t *) mem_frame_to_pa(frame) + page_offset, chunk);
+		vm_unlock_page(inode->pagecache, frame);
+
+		nread += chunk;
+		offset += chunk;
+	}
+
+	return nread > 0 ? (int) nread : rc;
 }
 
-int vfs_write(struct inode *inode, void *buf, size_t len)
+/*
+ * Write len bytes to given file, starting at given offset,
+ * extending the file if necessary.  The data is written to
+ * the file's page cache; vfs_close() writes it back.
+ * Returns the number of bytes written, or an error code
+ * if no bytes could be written.
+ */
+int vfs_write(struct inode *inode, void *buf, size_t len, ulong_t offset)
 {
-	/* TODO */
-	return -1;
+	int rc = 0;
+	size_t nwritten = 0, chunk, page_offset;
+	struct frame *frame;
+
+	if (inode->type != VFS_FILE) {
+		return EINVAL;
+	}
+	if (offset + len < offset) {
+		return EINVAL;
+	}
+
+	/* writing past the end leaves a hole, which must read as zeroes */
+	mutex_lock(&inode->lock);
+	if (offset > inode->size) {
+		rc = vfs_zero_eof_page(inode);
+	}
+	mutex_unlock(&inode->lock);
+	if (rc != 0) {
+		return rc;
+	}
+
+	while (nwritten < len) {
+		page_offset = offset & ~PAGE_MASK;
+		chunk = range_umin(PAGE_SIZE - page_offset, len - nwritten);
+
+		/* the old contents are only needed if part of the page is kept */
+		if (chunk == PAGE_SIZE) {
+			rc = vm_lock_new_page(inode->pagecache, offset >> PAGE_POWER, &frame);
+		} else {
+			rc = vfs_lock_file_page(inode, offset >> PAGE_POWER, &frame);
+		}
+		if (rc != 0) {
+			break;
+		}
+		memcpy((u8_t *) mem_frame_to_pa(frame) + page_offset, (u8_t *) buf + nwritten, chunk);
+		vm_set_page_dirty(inode->pagecache, frame);
+		vm_unlock_page(inode->pagecache, frame);
+
+		nwritten += chunk;
+		offset += chunk;
+
+		/* extend the file */
+		mutex_lock(&inode->lock);
+		if (offset > inode->size) {
+			inode->size = offset;
+			inode->size_dirty = true;
+		}
+		mutex_unlock(&inode->lock);
+	}
+
+	return nwritten > 0 ? (int) nwritten : rc;
+}
+
+/*
+ * Read given range of pages of a file into its page cache,
+ * stopping at the end of the file's data on disk or at the
+ * first error.
+ */
+void vfs_readahead(struct inode *inode, u32_t page_num, unsigned num_pages)
+{
+	struct frame *frame;
+	u32_t end_page = page_num + num_pages;
+	u32_t file_pages = mem_round_to_page(inode->disk_size) >> PAGE_POWER;
+
+	KASSERT(inode->type == VFS_FILE);
+
+	for (; page_num != end_page && page_num < file_pages; page_num++) {
+		if (vm_lock_page(inode->pagecache, page_num, &frame) != 0) {
+			break;
+		}
+		vm_unlock_page(inode->pagecache, frame);
+	}
 }
 
+/*
+ * Close given inode: write back its modified data (and its size,
+ * if the filesystem supports it), and release the reference to it.
+ * Returns 0 if successful, or an error code if the data
+ * could not be written back (the reference is released anyway).
+ */
 int vfs_close(struct inode *inode)
 {
-	/* TODO */
-	return -1;
+	int rc = 0;
+
+	if (inode->type == VFS_FILE) {
+		rc = vfs_sync_inode(inode);
+	}
+	vfs_release_ref(inode);
+
+	return rc;
 }
 
 /*
@@ -516,16 +1208,25 @@ int vfs_close(struct inode *inode)
  */
 int vfs_register_fs_driver(struct fs_driver *fs)
 {
-	mutex_lock(&s_driver_list_mutex);
+	rwlock_write_lock(&s_driver_list_lock);
 
 	fs->next = s_driver_list;
 	s_driver_list = fs;
 
-	mutex_unlock(&s_driver_list_mutex);
+	rwlock_write_unlock(&s_driver_list_lock);
 
 	return 0;
 }
 
+/*
+ * Add a reference to an inode the caller already holds a reference
+ * to (directly, or through one of its children).
+ */
+void vfs_add_ref(struct inode *inode)
+{
+	vfs_get_ref(inode);
+}
+
 /*
  * Create an fs_instance object.
  *
@@ -555,15 +1256,19 @@ int vfs_fs_instance_create(struct fs_instance_ops *ops, void *p, struct fs_insta
  *   parent - the parent inode
  *   type - the type of inode (file or directory)
  *   name - string containing name of file or directory
+ *   size - size of the file on disk, in bytes
  *   p_inode - where the pointer to the new inode object should be returned
  */
 int vfs_inode_create(
 	struct inode_ops *ops, struct fs_instance *fs_inst, struct inode *parent,
-	vfs_inode_type_t type, char *name,
+	vfs_inode_type_t type, char *name, ulong_t size,
 	void *p,
 	struct inode **p_inode)
 {
+	int rc;
 	struct inode *inode;
+	struct vm_pager *pager;
+	bool iflag;
 
 	inode = mem_alloc(sizeof(struct inode));
 	inode->ops = ops;
@@ -571,10 +1276,33 @@ int vfs_inode_create(
 	inode->parent = parent;
 	inode->type = type;
 	inode->name = name;
+	inode->name_hash = name != 0 ? vfs_name_hash(name) : 0;
+	inode->size = size;
+	inode->disk_size = size;
 	inode->p = p;
+	mutex_init(&inode->lock);
 	/* can omit initialization of other fields because
 	 * mem_alloc() has already zeroed the buffer */
 
+	/* file data is accessed through a page cache */
+	if (type == VFS_FILE) {
+		rc = vm_pager_create(&s_vfs_pager_ops, inode, &pager);
+		if (rc == 0) {
+			rc = vm_pagecache_create(pager, &inode->pagecache);
+			if (rc != 0) {
+				mem_free(pager);
+			}
+		}
+		if (rc != 0) {
+			mem_free(inode);
+			return rc;
+		}
+	}
+
+	iflag = int_begin_atomic();
+	s_num_inodes++;
+	int_end_atomic(iflag);
+
 	*p_inode = inode;
 	return 0;
 }
@@ -18,6 +18,7 @@
  */
 
 #include <geekos/vm.h>
+#include <geekos/string.h>
 
 static void vm_release_frame_ref(struct vm_pagecache *obj, struct frame *frame)
 {
@@ -38,6 +39,25 @@ static void vm_release_frame_ref(struct vm_pagecache *obj, struct frame *frame)
 	}
 }
 
+/*
+ * Find the frame holding given page, if it is present.
+ */
+static struct frame *vm_find_page(struct vm_pagecache *obj, u32_t page_num)
+{
+	struct frame *frame;
+
+	KASSERT(MUTEX_IS_HELD(&obj->lock));
+
+	for (frame = frame_list_get_first(&obj->pagelist);
+	     frame != 0;
+	     frame = frame_list_next(frame)) {
+		if (frame->vm_pgcache_page_num == page_num) {
+			break;
+		}
+	}
+	return frame;
+}
+
 static int vm_alloc_and_page_in(struct vm_pagecache *obj, u32_t page_num, struct frame **p_frame)
 {
 	int rc;
@@ -49,6 +69,7 @@ static int vm_alloc_and_page_in(struct vm_pagecache *obj, u32_t page_num, struct
 	frame = mem_alloc_frame(FRAME_VM_PGCACHE, 1);
 
 	/* append frame to pagelist, mark as having pending I/O */
+	frame->vm_pgcache_page_num = page_num;
 	frame_list_append(&obj->pagelist, frame);
 	frame->content = PAGE_PENDING_INIT;
 
@@ -66,6 +87,7 @@ static int vm_alloc_and_page_in(struct vm_pagecache *obj, u32_t page_num, struct
 
 	/* update frame content based on success/failure of pagein */
 	frame->content = (rc == 0) ? PAGE_CLEAN : PAGE_FAILED_INIT;
+	frame->errc = rc;
 
 	/* other threads may be waiting to learn content state */
 	cond_broadcast(&obj->cond);
@@ -137,18 +159,27 @@ int vm_pagecache_create(struct vm_pager *pager, struct vm_pagecache **p_obj)
 }
 
 /*
- * Lock a page in a vm_pagecache.
- * A page cannot be stolen from its vm_pagecache
- * while it is locked.
- *
- * Parameters:
- *   obj - the vm_pagecache
- *   page_num - which page to lock
- *   p_frame - where to return the pointer to the frame containing the page data
+ * Destroy a vm_pagecache, freeing its pages (which must not be
+ * locked, and should have been written back with vm_pagecache_sync()).
+ * The pager is not destroyed.
  */
-int vm_lock_page(struct vm_pagecache *obj, u32_t page_num, struct frame **p_frame)
+void vm_pagecache_destroy(struct vm_pagecache *obj)
 {
-	int rc;
+	struct frame *frame;
+
+	while ((frame = frame_list_remove_first(&obj->pagelist)) != 0) {
+		KASSERT(frame->refcount == 0);
+		mem_free_frame(frame);
+	}
+	mem_free(obj);
+}
+
+/*
+ * Common implementation of vm_lock_page() and vm_lock_new_page().
+ */
+static int vm_lock_page_imp(struct vm_pagecache *obj, u32_t page_num, bool pagein, struct frame **p_frame)
+{
+	int rc = 0;
 	struct frame *frame;
 
 	mutex_lock(&obj->lock);
@@ -156,21 +187,28 @@ int vm_lock_page(struct vm_pagecache *obj, u32_t page_num, struct frame **p_fram
 	/*
 	 * See if page is already present.
 	 */
-	for (frame = frame_list_get_first(&obj->pagelist);
-	     frame != 0;
-	     frame = frame_list_next(frame)) {
-		if (frame->vm_pgcache_page_num == page_num) {
-			frame->refcount++; /* lock the frame! */
-			break;
-		}
+	frame = vm_find_page(obj, page_num);
+	if (frame != 0) {
+		frame->refcount++; /* lock the frame! */
 	}
 
-	if (frame == 0) {
+	if (frame == 0 && pagein) {
 		/*
 		 * Page not present yet; allocate it and
 		 * page in its contents.
 		 */
 		rc = vm_alloc_and_page_in(obj, page_num, p_frame);
+	} else if (frame == 0) {
+		/*
+		 * Page not present, and the caller does not need
+		 * its contents: start with a zero-filled page.
+		 */
+		frame = mem_alloc_frame(FRAME_VM_PGCACHE, 1);
+		memset(mem_frame_to_pa(frame), 0, PAGE_SIZE);
+		frame->vm_pgcache_page_num = page_num;
+		frame->content = PAGE_DIRTY;
+		frame_list_append(&obj->pagelist, frame);
+		*p_frame = frame;
 	} else {
 		/*
 		 * Page is present; make sure its contents
@@ -195,6 +233,38 @@ int vm_lock_page(struct vm_pagecache *obj, u32_t page_num, struct frame **p_fram
 	return rc;
 }
 
+/*
+ * Lock a page in a vm_pagecache.
+ * A page cannot be stolen from its vm_pagecache
+ * while it is locked.
+ *
+ * Parameters:
+ *   obj - the vm_pagecache
+ *   page_num - which page to lock
+ *   p_frame - where to return the pointer to the frame containing the page data
+ */
+int vm_lock_page(struct vm_pagecache *obj, u32_t page_num, struct frame **p_frame)
+{
+	return vm_lock_page_imp(obj, page_num, true, p_frame);
+}
+
+/*
+ * Lock a page in a vm_pagecache whose current contents are
+ * not needed, because the caller will overwrite all of it,
+ * or because it lies beyond the end of the data store.
+ * If the page is not present, it is added zero-filled
+ * (and dirty) without reading the pager.
+ *
+ * Parameters:
+ *   obj - the vm_pagecache
+ *   page_num - which page to lock
+ *   p_frame - where to return the pointer to the frame containing the page data
+ */
+int vm_lock_new_page(struct vm_pagecache *obj, u32_t page_num, struct frame **p_frame)
+{
+	return vm_lock_page_imp(obj, page_num, false, p_frame);
+}
+
 /*
  * Unlock a page in a vm_pagecache.
  *
@@ -216,3 +286,75 @@ int vm_unlock_page(struct vm_pagecache *obj, struct frame *frame)
 	return rc;
 }
 
+/*
+ * Mark a locked page as modified, so that vm_pagecache_sync()
+ * will write it back to the pager.
+ */
+void vm_set_page_dirty(struct vm_pagecache *obj, struct frame *frame)
+{
+	mutex_lock(&obj->lock);
+
+	KASSERT(frame->refcount > 0);
+	KASSERT(frame->content == PAGE_CLEAN || frame->content == PAGE_DIRTY);
+	frame->content = PAGE_DIRTY;
+
+	mutex_unlock(&obj->lock);
+}
+
+/*
+ * Write all dirty pages in a vm_pagecache back to its pager.
+ * Returns 0 if successful, or the error code of the first
+ * failed pageout (the page remains dirty).
+ */
+int vm_pagecache_sync(struct vm_pagecache *obj)
+{
+	int rc = 0, pageout_rc;
+	struct frame *frame;
+	bool found;
+
+	mutex_lock(&obj->lock);
+
+	do {
+		found = false;
+		for (frame = frame_list_get_first(&obj->pagelist);
+		     frame != 0;
+		     frame = frame_list_next(frame)) {
+			if (frame->content == PAGE_DIRTY) {
+				found = true;
+				break;
+			}
+		}
+
+		if (found) {
+			/*
+			 * Mark the page clean before writing it, so that
+			 * a write made while the pageout is in progress
+			 * marks it dirty again.  The lock keeps the frame
+			 * in the pagecache while its mutex is released.
+			 */
+			frame->refcount++;
+			frame->content = PAGE_CLEAN;
+			mutex_unlock(&obj->lock);
+
+			pageout_rc = vm_pageout(obj->pager, frame->vm_pgcache_page_num, frame);
+
+			mutex_lock(&obj->lock);
+			if (pageout_rc != 0) {
+				frame->content = PAGE_DIRTY;
+				if (rc == 0) {
+					rc = pageout_rc;
+				}
+			}
+			vm_release_frame_ref(obj, frame);
+
+			if (pageout_rc != 0) {
+				/* don't retry forever */
+				break;
+			}
+		}
+	} while (found);
+
+	mutex_unlock(&obj->lock);
+
+	return rc;
+}
@@ -24,85 +24,500 @@
 #include <geekos/mem.h>
 #include <geekos/kassert.h>
 
-struct workqueue_item;
+/*
+ * NOTES:
+ * - All workqueue state is protected by disabling interrupts.
+ * - nr_running counts workers executing an item which are not
+ *   blocked.  The scheduler calls workqueue_worker_sleeping()
+ *   and workqueue_worker_waking() when a worker blocks and resumes,
+ *   so that a blocked item does not stall the rest of the queue.
+ * - New workers can't be created from inside the scheduler
+ *   (mem_alloc may block), so that job is handed to the manager thread.
+ * - A work callback may free its work object, so a worker never
+ *   touches the work object after invoking the callback.
+ */
 
-struct workqueue_item {
-	void (*callback)(void *);
-	void *data;
-	struct workqueue_item *next;
+/*
+ * A worker thread belonging to a workqueue.
+ */
+struct workqueue_worker {
+	struct workqueue *wq;
+	struct thread *thread;
+	struct work *current_work;       /* work being executed, 0 if none */
+	bool busy;                       /* true while executing a work item */
+	struct workqueue_worker *next;
 };
 
-/* queue of workqueue items */
-struct workqueue_item *s_workqueue_head, *s_workqueue_tail;
+/*
+ * A named workqueue.
+ */
+struct workqueue {
+	const char *name;
+	struct work_list highpri_list;   /* high-priority pending work */
+	struct work_list normal_list;    /* normal-priority pending work */
+	int nr_pending;                  /* number of pending work items */
+	int nr_busy;                     /* number of workers executing work */
+	int nr_running;                  /* number of busy workers not blocked */
+	int nr_workers;                  /* number of workers (including ones being created) */
+	int max_workers;                 /* limit on nr_workers */
+	bool need_worker;                /* true if the manager should create a worker */
+	struct thread_queue idle_queue;  /* idle workers wait here */
+	struct thread_queue done_queue;  /* flush/cancel wait here for work to finish */
+	struct workqueue_worker *workers;
+	struct workqueue *next;
+};
 
-/* wait queue in which the workqueue thread waits for new items */
-struct thread_queue s_waitqueue;
+IMPLEMENT_LIST_CLEAR(work_list, work)
+IMPLEMENT_LIST_IS_EMPTY(work_list, work)
+IMPLEMENT_LIST_APPEND(work_list, work)
+IMPLEMENT_LIST_REMOVE_FIRST(work_list, work)
+IMPLEMENT_LIST_REMOVE(work_list, work)
+
+struct workqueue *g_system_wq;
+struct workqueue *g_io_wq;
+
+/* all workqueues */
+static struct workqueue *s_workqueue_list;
+
+/* wait queue in which the manager thread waits for requests */
+static struct thread_queue s_manager_waitqueue;
+
+static void workqueue_worker_thread(ulong_t arg);
 
 /*
- * Work queue thread: wait for items to arrive and invoke each item's callback.
+ * Create a new worker thread for given workqueue.
+ * The caller must already have counted it in wq->nr_workers.
  */
-static void workqueue_thread(ulong_t arg)
+static void workqueue_create_worker(struct workqueue *wq)
 {
-	while (true) {
-		struct workqueue_item *item;
+	bool iflag;
+	struct workqueue_worker *worker;
 
-		int_disable();
+	worker = mem_alloc(sizeof(struct workqueue_worker));
+	worker->wq = wq;
 
-		/* wait for an item to arrive */
-		while (s_workqueue_head == 0) {
-			thread_wait(&s_waitqueue);
+	iflag = int_begin_atomic();
+	worker->next = wq->workers;
+	wq->workers = worker;
+	int_end_atomic(iflag);
+
+	thread_create(&workqueue_worker_thread, (ulong_t) worker, THREAD_DETACHED);
+}
+
+/*
+ * Make sure some worker will pick up pending work on given workqueue:
+ * wake an idle worker, or ask the manager to create one.
+ * Interrupts must be disabled.
+ */
+static void workqueue_kick(struct workqueue *wq)
+{
+	KASSERT(!int_enabled());
+
+	/* keep one running worker per CPU */
+	if (wq->nr_pending == 0 || wq->nr_running >= g_num_cpus) {
+		return;
+	}
+
+	if (!thread_queue_is_empty(&wq->idle_queue)) {
+		thread_wakeup_one(&wq->idle_queue);
+	} else if (wq->nr_workers == wq->nr_busy &&
+		   wq->nr_workers < wq->max_workers && !wq->need_worker) {
+		/* every worker is busy (and at least one is blocked) */
+		wq->need_worker = true;
+		wq->nr_workers++;
+		thread_wakeup_one(&s_manager_waitqueue);
+	}
+}
+
+/*
+ * Remove the next pending work item from given workqueue,
+ * or return 0 if there is none.  Interrupts must be disabled.
+ */
+static struct work *workqueue_dequeue(struct workqueue *wq)
+{
+	struct work *work;
+
+	KASSERT(!int_enabled());
+
+	if (!work_list_is_empty(&wq->highpri_list)) {
+		work = work_list_remove_first(&wq->highpri_list);
+	} else if (!work_list_is_empty(&wq->normal_list)) {
+		work = work_list_remove_first(&wq->normal_list);
+	} else {
+		return 0;
+	}
+
+	work->flags &= ~(WORK_PENDING | WORK_HIGHPRI);
+	wq->nr_pending--;
+	return work;
+}
+
+/*
+ * Add work to a workqueue.
+ * Returns false if the work was already pending.
+ */
+static bool workqueue_enqueue(struct workqueue *wq, struct work *work, bool highpri)
+{
+	bool iflag, queued = false;
+
+	iflag = int_begin_atomic();
+
+	if (!(work->flags & WORK_PENDING)) {
+		work->wq = wq;
+		work->flags |= WORK_PENDING;
+		if (highpri) {
+			work->flags |= WORK_HIGHPRI;
+			work_list_append(&wq->highpri_list, work);
+		} else {
+			work_list_append(&wq->normal_list, work);
 		}
+		wq->nr_pending++;
+		workqueue_kick(wq);
+		queued = true;
+	}
 
-		/* Get the next item */
-		item = s_workqueue_head;
-		s_workqueue_head = s_workqueue_head->next;
-		if (s_workqueue_head == 0) {
-			s_workqueue_tail = 0;
+	int_end_atomic(iflag);
+
+	return queued;
+}
+
+/*
+ * Worker thread: wait for items to arrive and invoke each item's callback.
+ */
+static void workqueue_worker_thread(ulong_t arg)
+{
+	struct workqueue_worker *worker = (struct workqueue_worker *) arg;
+	struct workqueue *wq = worker->wq;
+
+	worker->thread = percpu_read(g_current);
+	worker->thread->wq_worker = worker;
+
+	int_disable();
+
+	while (true) {
+		struct work *work;
+
+		/* wait for an item to arrive */
+		work = workqueue_dequeue(wq);
+		if (work == 0) {
+			thread_wait(&wq->idle_queue);
+			continue;
 		}
 
+		worker->current_work = work;
+		worker->busy = true;
+		wq->nr_busy++;
+		wq->nr_running++;
+
+		int_enable();
+
+		/* do the work: the work object may be freed by the callback */
+		work->func(work->data);
+
+		int_disable();
+
+		worker->current_work = 0;
+		worker->busy = false;
+		wq->nr_busy--;
+		wq->nr_running--;
+
+		/* notify threads in flush/cancel */
+		thread_wakeup(&wq->done_queue);
+	}
+}
+
+/*
+ * Manager thread: create worker threads on behalf of workqueues
+ * whose workers are all blocked.
+ */
+static void workqueue_manager_thread(ulong_t arg)
+{
+	while (true) {
+		struct workqueue *wq;
+
+		int_disable();
+		while (true) {
+			for (wq = s_workqueue_list; wq != 0; wq = wq->next) {
+				if (wq->need_worker) {
+					break;
+				}
+			}
+			if (wq != 0) {
+				break;
+			}
+			thread_wait(&s_manager_waitqueue);
+		}
+		wq->need_worker = false;
 		int_enable();
 
-		/* do the work and delete the item */
-		item->callback(item->data);
-		mem_free(item);
+		workqueue_create_worker(wq);
+	}
+}
+
+/*
+ * Return true if the current thread is a worker of given workqueue.
+ */
+static bool workqueue_is_current_worker(struct workqueue *wq)
+{
+	struct workqueue_worker *worker = percpu_read(g_current)->wq_worker;
+	return worker != 0 && worker->wq == wq;
+}
+
+/*
+ * Return true if any worker of given workqueue is executing given work.
+ * Interrupts must be disabled.
+ */
+static bool workqueue_is_running(struct workqueue *wq, struct work *work)
+{
+	struct workqueue_worker *worker;
+
+	KASSERT(!int_enabled());
+
+	for (worker = wq->workers; worker != 0; worker = worker->next) {
+		if (worker->current_work == work) {
+			return true;
+		}
 	}
+	return false;
 }
 
 /*
- * Initialize work queue.
+ * Initialize work queues.
  */
 void workqueue_init(void)
 {
-	thread_create(&workqueue_thread, 0UL, THREAD_DETACHED);
+	thread_queue_clear(&s_manager_waitqueue);
+	thread_create(&workqueue_manager_thread, 0UL, THREAD_DETACHED);
+
+	g_system_wq = workqueue_create("system", 4);
+	g_io_wq = workqueue_create("io", 4);
 }
 
 /*
- * Add an item to be processed by the work queue.
+ * Create a workqueue with given name, which may use
+ * at most max_workers worker threads.
  */
-void workqueue_schedule_work(void (*callback)(void *), void *data)
+struct workqueue *workqueue_create(const char *name, int max_workers)
 {
 	bool iflag;
-	struct workqueue_item *item;
+	struct workqueue *wq;
 
-	/* create new item */
-	item = mem_alloc(sizeof(struct workqueue_item));
-	item->callback = callback;
-	item->data = data;
-	item->next = 0;
+	KASSERT(max_workers > 0);
+
+	wq = mem_alloc(sizeof(struct workqueue));
+	wq->name = name;
+	work_list_clear(&wq->highpri_list);
+	work_list_clear(&wq->normal_list);
+	thread_queue_clear(&wq->idle_queue);
+	thread_queue_clear(&wq->done_queue);
+	wq->max_workers = max_workers;
+	wq->nr_workers = 1;
 
 	iflag = int_begin_atomic();
+	wq->next = s_workqueue_list;
+	s_workqueue_list = wq;
+	int_end_atomic(iflag);
 
-	/* add to tail of queue */
-	if (s_workqueue_head == 0) {
-		s_workqueue_head = s_workqueue_tail = item;
-	} else {
-		KASSERT(s_workqueue_tail != 0);
-		s_workqueue_tail->next = item;
-		s_workqueue_tail = item;
+	/* start with one worker: more are created on demand */
+	workqueue_create_worker(wq);
+
+	return wq;
+}
+
+/*
+ * Initialize a work object.
+ */
+void work_init(struct work *work, void (*func)(void *), void *data)
+{
+	work->func = func;
+	work->data = data;
+	work->wq = 0;
+	work->flags = 0;
+}
+
+/*
+ * Add work to given workqueue.
+ * Returns false if the work was already pending.
+ */
+bool workqueue_queue_work(struct workqueue *wq, struct work *work)
+{
+	return workqueue_enqueue(wq, work, false);
+}
+
+/*
+ * Add work to the high-priority queue of given workqueue:
+ * it will be started before any normal-priority work.
+ * Returns false if the work was already pending.
+ */
+bool workqueue_queue_work_highpri(struct workqueue *wq, struct work *work)
+{
+	return workqueue_enqueue(wq, work, true);
+}
+
+/*
+ * Add work to the system workqueue.
+ */
+void workqueue_schedule_work(struct work *work)
+{
+	workqueue_queue_work(g_system_wq, work);
+}
+
+/*
+ * Timer callback for delayed work: queue the work.
+ */
+static void workqueue_delayed_work_timer(void *data)
+{
+	struct delayed_work *dwork = data;
+	workqueue_queue_work(dwork->target, &dwork->work);
+}
+
+/*
+ * Initialize a delayed work object.
+ */
+void delayed_work_init(struct delayed_work *dwork, void (*func)(void *), void *data)
+{
+	work_init(&dwork->work, func, data);
+	timer_setup(&dwork->timer, &workqueue_delayed_work_timer, dwork);
+	dwork->target = 0;
+}
+
+/*
+ * Add work to given workqueue after given number of ticks.
+ * Returns false if the work was already pending or waiting for its delay.
+ */
+bool workqueue_queue_delayed_work(struct workqueue *wq, struct delayed_work *dwork, u32_t ticks)
+{
+	bool iflag, queued = false;
+
+	if (ticks == 0) {
+		return workqueue_queue_work(wq, &dwork->work);
+	}
+
+	iflag = int_begin_atomic();
+	if (!(dwork->work.flags & WORK_PENDING) && !timer_is_armed(&dwork->timer)) {
+		dwork->target = wq;
+		timer_arm(&dwork->timer, ticks);
+		queued = true;
 	}
+	int_end_atomic(iflag);
+
+	return queued;
+}
 
-	/* notify workqueue thread */
-	thread_wakeup_one(&s_waitqueue);
+/*
+ * Cancel delayed work, whether it is still waiting for its
+ * delay or has been queued.  Returns true if it was cancelled.
+ */
+bool workqueue_cancel_delayed_work(struct delayed_work *dwork)
+{
+	bool iflag, cancelled;
 
+	iflag = int_begin_atomic();
+	cancelled = timer_cancel(&dwork->timer);
+	if (!cancelled) {
+		cancelled = workqueue_cancel_work(&dwork->work);
+	}
 	int_end_atomic(iflag);
+
+	return cancelled;
+}
+
+/*
+ * Cancel pending work.
+ * Returns true if the work was pending and has been removed,
+ * false if it was not pending (it may still be running).
+ */
+bool workqueue_cancel_work(struct work *work)
+{
+	bool iflag, cancelled = false;
+
+	iflag = int_begin_atomic();
+
+	if (work->flags & WORK_PENDING) {
+		struct workqueue *wq = work->wq;
+		work_list_remove((work->flags & WORK_HIGHPRI) ? &wq->highpri_list : &wq->normal_list, work);
+		work->flags &= ~(WORK_PENDING | WORK_HIGHPRI);
+		wq->nr_pending--;
+		thread_wakeup(&wq->done_queue);
+		cancelled = true;
+	}
+
+	int_end_atomic(iflag);
+
+	return cancelled;
+}
+
+/*
+ * Cancel pending work, and wait for it to finish if it is running.
+ * Must not be called from the work's own callback.
+ * Returns true if the work was pending.
+ */
+bool workqueue_cancel_work_sync(struct work *work)
+{
+	bool iflag, cancelled;
+	struct workqueue *wq;
+
+	cancelled = workqueue_cancel_work(work);
+
+	iflag = int_begin_atomic();
+	wq = work->wq;
+	if (wq != 0) {
+		KASSERT(percpu_read(g_current)->wq_worker == 0 ||
+			percpu_read(g_current)->wq_worker->current_work != work);
+		while (workqueue_is_running(wq, work)) {
+			thread_wait(&wq->done_queue);
+		}
+	}
+	int_end_atomic(iflag);
+
+	return cancelled;
+}
+
+/*
+ * Wait until given workqueue has no pending or running work.
+ * Must not be called from one of the workqueue's own workers.
+ */
+void workqueue_flush(struct workqueue *wq)
+{
+	bool iflag;
+
+	KASSERT(!workqueue_is_current_worker(wq));
+
+	iflag = int_begin_atomic();
+	while (wq->nr_pending > 0 || wq->nr_busy > 0) {
+		thread_wait(&wq->done_queue);
+	}
+	int_end_atomic(iflag);
+}
+
+/*
+ * Called by the scheduler when a worker thread is about to block.
+ * If the worker was executing work, another worker is
+ * started so pending work can make progress.
+ */
+void workqueue_worker_sleeping(struct workqueue_worker *worker)
+{
+	struct workqueue *wq = worker->wq;
+
+	KASSERT(!int_enabled());
+
+	if (!worker->busy) {
+		return;
+	}
+
+	KASSERT(wq->nr_running > 0);
+	wq->nr_running--;
+	workqueue_kick(wq);
+}
+
+/*
+ * Called by the scheduler when a blocked worker thread resumes.
+ */
+void workqueue_worker_waking(struct workqueue_worker *worker)
+{
+	KASSERT(!int_enabled());
+
+	if (worker->busy) {
+		worker->wq->nr_running++;
+	}
 }
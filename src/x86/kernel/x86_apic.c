@@ -0,0 +1,194 @@
+/*
+ * GeekOS - x86 local APIC and I/O APIC
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <geekos/int.h>
+#include <geekos/kassert.h>
+#include <geekos/cons.h>
+#include <arch/cpu.h>
+#include <arch/apic.h>
+
+/*
+ * NOTES:
+ * - The I/O APIC is assumed to be at its default address, and ISA
+ *   IRQs are assumed to be identity-mapped to I/O APIC pins, except
+ *   IRQ 0 (the PIT), which is wired to pin 2.  IRQ 2 is the PIC
+ *   cascade, which never interrupts, so it is not routed (it would
+ *   overwrite IRQ 0's entry on pin 2).  This is the standard
+ *   PC layout (and what QEMU provides); a full implementation would
+ *   read the ACPI MADT interrupt source overrides.
+ * - All IRQs are delivered to the boot CPU in fixed, physical
+ *   destination mode.  ISA IRQs are edge-triggered, active high.
+ * - Interrupt priorities (the task priority register) are not used,
+ *   and the TPR is left at 0.  The ISA IRQ vectors (32-47) all fall
+ *   in priority class 2, so the TPR cannot order them; handlers run
+ *   with interrupts disabled until the EOI, so there is no nesting
+ *   for it to order; and the kernel's critical sections need to
+ *   hold off all interrupts (int_begin_atomic()) or single IRQs
+ *   (irq_disable()), neither of which a priority threshold gives.
+ */
+
+static volatile u32_t *s_lapic;
+static volatile u32_t *s_ioapic;
+static bool s_apic_enabled;
+static int s_first_irq_vector;
+static int s_num_pins;
+
+/* local APIC id of the boot CPU */
+static u32_t s_boot_apic_id;
+
+static __inline__ u32_t ioapic_read(u32_t reg)
+{
+	s_ioapic[IOAPIC_REGSEL / 4] = reg;
+	return s_ioapic[IOAPIC_WIN / 4];
+}
+
+static __inline__ void ioapic_write(u32_t reg, u32_t value)
+{
+	s_ioapic[IOAPIC_REGSEL / 4] = reg;
+	s_ioapic[IOAPIC_WIN / 4] = value;
+}
+
+/*
+ * Map an ISA IRQ to its I/O APIC pin.
+ */
+static int ioapic_pin(int irq)
+{
+	return (irq == 0) ? 2 : irq;
+}
+
+/*
+ * Program the redirection entry for given IRQ.
+ */
+static void ioapic_route_irq(int irq, bool masked)
+{
+	int pin = ioapic_pin(irq);
+	u32_t lo = s_first_irq_vector + irq;
+
+	/* IRQ 2 (the cascade) has no pin of its own: pin 2 belongs to IRQ 0 */
+	if (irq == 2 || pin >= s_num_pins) {
+		return;
+	}
+	if (masked) {
+		lo |= IOAPIC_REDIR_MASKED;
+	}
+
+	/* mask first, so the entry is never half-written while enabled */
+	ioapic_write(IOAPIC_REG_REDTBL(pin), IOAPIC_REDIR_MASKED);
+	ioapic_write(IOAPIC_REG_REDTBL(pin) + 1, s_boot_apic_id << 24);
+	ioapic_write(IOAPIC_REG_REDTBL(pin), lo);
+}
+
+static void lapic_spurious_handler(struct thread_context *context)
+{
+	/* spurious interrupts must not be acknowledged */
+}
+
+u32_t lapic_read(u32_t reg)
+{
+	return s_lapic[reg / 4];
+}
+
+void lapic_write(u32_t reg, u32_t value)
+{
+	s_lapic[reg / 4] = value;
+}
+
+/*
+ * Detect and enable the local APIC and I/O APIC.
+ * IRQs 0..num_irqs-1 are routed to vectors starting at first_irq_vector,
+ * initially masked.  Returns false if the APICs can't be used,
+ * in which case the caller should use the 8259A PICs.
+ */
+bool apic_init(int first_irq_vector, int num_irqs)
+{
+	struct x86_cpuid_info cpuid;
+	u64_t apic_base;
+	int irq, pin;
+
+	if (!x86_cpuid(&cpuid) || !cpuid.feature_info_edx.apic || !cpuid.feature_info_edx.msr) {
+		return false;
+	}
+
+	/* the local APIC must be where we have mapped it */
+	apic_base = x86_rdmsr(MSR_APIC_BASE);
+	if ((apic_base & MSR_APIC_BASE_ADDR) != LAPIC_DEFAULT_BASE) {
+		return false;
+	}
+	x86_wrmsr(MSR_APIC_BASE, apic_base | MSR_APIC_BASE_ENABLE);
+
+	s_lapic = (volatile u32_t *) LAPIC_DEFAULT_BASE;
+	s_ioapic = (volatile u32_t *) IOAPIC_DEFAULT_BASE;
+
+	/* make sure there is an I/O APIC */
+	s_num_pins = ((ioapic_read(IOAPIC_REG_VER) >> 16) & 0xFF) + 1;
+	if (ioapic_read(IOAPIC_REG_VER) == 0xFFFFFFFFUL || s_num_pins < 16) {
+		return false;
+	}
+
+	s_first_irq_vector = first_irq_vector;
+	s_boot_apic_id = lapic_read(LAPIC_ID) >> 24;
+
+	/* enable the local APIC, mask the local interrupt sources */
+	int_install_handler(LAPIC_SPURIOUS_VECTOR, &lapic_spurious_handler);
+	lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+	lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+	lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_MASKED);
+	lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+
+	/* accept interrupts of all priorities (see NOTES) */
+	lapic_write(LAPIC_TPR, 0);
+
+	/* mask every pin, then route the ISA IRQs (still masked) */
+	for (pin = 0; pin < s_num_pins; pin++) {
+		ioapic_write(IOAPIC_REG_REDTBL(pin), IOAPIC_REDIR_MASKED);
+	}
+	for (irq = 0; irq < num_irqs; irq++) {
+		ioapic_route_irq(irq, true);
+	}
+
+	s_apic_enabled = true;
+	return true;
+}
+
+/*
+ * Return true if interrupts are being delivered by the APICs.
+ */
+bool apic_is_enabled(void)
+{
+	return s_apic_enabled;
+}
+
+/*
+ * Mask or unmask given IRQ at the I/O APIC.
+ */
+void apic_set_irq_masked(int irq, bool masked)
+{
+	KASSERT(s_apic_enabled);
+	ioapic_route_irq(irq, masked);
+}
+
+/*
+ * Signal end of interrupt to the local APIC.
+ */
+void lapic_eoi(void)
+{
+	lapic_write(LAPIC_EOI, 0);
+}
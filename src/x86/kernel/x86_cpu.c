@@ -20,6 +20,7 @@
 #include <geekos/types.h>
 #include <geekos/string.h>
 #include <geekos/kassert.h>
+#include <geekos/percpu.h>
 #include <arch/cpu.h>
 
 /* segment descriptor constants (upper word) */
@@ -33,11 +34,14 @@
 
 /* -------------------- Private -------------------- */
 
-#define GDT_LEN 4
+#define GDT_LEN 5
 
 static struct x86_segment_descriptor s_gdt[GDT_LEN];
 static struct x86_tss s_tss;
 
+/* the boot CPU uses the link-time copy of the per-CPU data section */
+DEFINE_PERCPU(ulong_t, g_percpu_offset) = 0;
+
 #if 0
 static void dump_gdt(void)
 {
@@ -69,6 +73,8 @@ static void x86_seg_init_base_and_limit(
 
 /* -------------------- Public -------------------- */
 
+int g_num_cpus = 1;
+
 void x86_seg_init_code(struct x86_segment_descriptor *desc, u32_t base, u32_t num_pages, int priv)
 {
 	KASSERT(priv >= 0 && priv <= 3);
@@ -118,6 +124,7 @@ void x86_seg_init_gdt(void)
 	x86_seg_init_code(&s_gdt[1], 0, 1048576, PRIV_KERN);
 	x86_seg_init_data(&s_gdt[2], 0, 1048576, PRIV_KERN);
 	x86_seg_init_tss(&s_gdt[3], &s_tss);
+	x86_seg_init_data(&s_gdt[4], g_percpu_offset, 1048576, PRIV_KERN);
 	/* TODO: user code/data */
 
 	/* load the GDTR */
@@ -244,5 +251,15 @@ bool x86_cpuid(struct x86_cpuid_info *cpuid_info)
 	memcpy(&cpuid_info->feature_info_edx, &edx, 4);
 	memcpy(&cpuid_info->feature_info_ecx, &ecx, 4);
 
+	/* eax=0x80000007: advanced power management (if supported) */
+	memset(&cpuid_info->apm_info_edx, '\0', 4);
+	eax = 0x80000000;
+	__asm__ __volatile__ ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (eax));
+	if (eax >= 0x80000007) {
+		eax = 0x80000007;
+		__asm__ __volatile__ ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (eax));
+		memcpy(&cpuid_info->apm_info_edx, &edx, 4);
+	}
+
 	return true;
 }
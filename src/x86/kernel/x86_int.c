@@ -21,12 +21,16 @@
 #include <geekos/types.h>
 #include <geekos/kassert.h>
 #include <geekos/int.h>
+#include <geekos/mem.h>
 #include <arch/cpu.h>
 #include <arch/thread.h>
 #include <arch/int.h>
 
 int_handler_t *g_int_handler_table[INT_NUM_INTERRUPTS];
 
+DEFINE_PERCPU(int, g_int_nesting);
+DEFINE_PERCPU(ulong_t, g_int_stack_top);
+
 static struct x86_interrupt_gate s_idt[INT_NUM_INTERRUPTS];
 
 static void int_unexpected_int_handler(struct thread_context *context)
@@ -42,6 +46,7 @@ void int_init(void)
 	int num_handler_stubs = (&int_handler_stub_vector_end - &int_handler_stub_vector);
 	int i;
 	u16_t limit_and_base[3];
+	u8_t *stack;
 
 	PANIC_IF(num_handler_stubs / INT_HANDLER_STUB_LEN != INT_NUM_INTERRUPTS,
 		"Interrupt handler stub vector has unexpected size");
@@ -57,6 +62,10 @@ void int_init(void)
 	limit_and_base[2] = ((ulong_t) s_idt) >> 16;
 	x86_load_idtr(limit_and_base);
 
+	/* allocate the interrupt stack */
+	stack = mem_alloc(INT_STACK_SIZE);
+	percpu_write(g_int_stack_top, (ulong_t) (stack + INT_STACK_SIZE));
+
 	/* initialize C interrupt handler function table */
 	for (i = 0; i < INT_NUM_INTERRUPTS; i++) {
 		g_int_handler_table[i] = &int_unexpected_int_handler;
@@ -86,6 +95,12 @@ void int_disable__(void)
 	__asm__ __volatile__ ("cli");
 }
 
+void int_wait__(void)
+{
+	/* sti delays interrupts until after the next instruction */
+	__asm__ __volatile__ ("sti; hlt");
+}
+
 #if 0
 void int_dump_stack_word(u32_t *addr, u32_t word)
 {
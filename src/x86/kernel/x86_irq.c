@@ -21,7 +21,19 @@
 #include <stdbool.h>
 #include <geekos/types.h>
 #include <geekos/irq.h>
+#include <geekos/cons.h>
 #include <arch/ioport.h>
+#include <arch/apic.h>
+
+/*
+ * NOTES:
+ * - External IRQs are delivered either by the I/O APIC (preferred)
+ *   or by the legacy 8259A PICs.  The PICs are always initialized,
+ *   so that they are remapped away from the CPU exception vectors;
+ *   when the APICs are used, every PIC input is masked.
+ * - The interrupt controller is accessed through an ops struct
+ *   chosen by irq_init().
+ */
 
 /*
  * i8259A definitions 
@@ -49,13 +61,87 @@
 #define NUM_IRQS 16
 #define VALID_IRQ(irq) ((irq) >= 0 && (irq) < NUM_IRQS)
 
+/*
+ * Interrupt controller operations.
+ */
+struct irq_controller_ops {
+	const char *name;
+	void (*set_mask)(irq_mask_t oldmask, irq_mask_t newmask);
+	void (*eoi)(int irq);
+};
+
 /*
  * Current IRQ mask.
  */
 static irq_mask_t s_irqmask;
 
 /*
- * Initialize i8259A interrupt controllers.
+ * Interrupt controller in use.
+ */
+static struct irq_controller_ops *s_irq_ops;
+
+/*
+ * 8259A PIC operations.
+ */
+static void pic_set_mask(irq_mask_t oldmask, irq_mask_t newmask)
+{
+	if (MASTER(newmask) != MASTER(oldmask)) {
+		ioport_outb(0x21, MASTER(newmask));
+	}
+	if (SLAVE(newmask) != SLAVE(oldmask)) {
+		ioport_outb(0xA1, SLAVE(newmask));
+	}
+}
+
+static void pic_eoi(int irq)
+{
+	u8_t command = 0x60 | (irq & 0x7);
+
+	if (irq < 8) {
+		/* Specific EOI to master PIC */
+		ioport_outb(0x20, command);
+	} else {
+		/* Specific EOI to slave PIC, then to master (cascade line) */
+		ioport_outb(0xA0, command);
+		ioport_outb(0x20, 0x62);
+	}
+}
+
+static struct irq_controller_ops s_pic_ops = {
+	.name = "8259A",
+	.set_mask = &pic_set_mask,
+	.eoi = &pic_eoi,
+};
+
+/*
+ * I/O APIC operations.
+ */
+static void ioapic_set_mask(irq_mask_t oldmask, irq_mask_t newmask)
+{
+	int irq;
+	irq_mask_t changed = oldmask ^ newmask;
+
+	for (irq = 0; irq < NUM_IRQS; irq++) {
+		if (changed & (1 << irq)) {
+			apic_set_irq_masked(irq, (newmask & (1 << irq)) != 0);
+		}
+	}
+}
+
+static void ioapic_eoi(int irq)
+{
+	/* a single MMIO write, rather than port I/O */
+	lapic_eoi();
+}
+
+static struct irq_controller_ops s_ioapic_ops = {
+	.name = "I/O APIC",
+	.set_mask = &ioapic_set_mask,
+	.eoi = &ioapic_eoi,
+};
+
+/*
+ * Initialize interrupt controllers.
  */
 void irq_init(void)
 {
@@ -71,6 +157,16 @@ void irq_init(void)
 	ioport_outb(0x21, 0xFB);        /* mask all ints but 2 in master; OCW1 to master */
 
 	s_irqmask = 0xfffb;
+	s_irq_ops = &s_pic_ops;
+
+	if (apic_init(FIRST_IRQ, NUM_IRQS)) {
+		/* mask everything at the PICs, and switch to the I/O APIC */
+		ioport_outb(0x21, 0xFF);
+		s_irqmask = 0xffff;
+		s_irq_ops = &s_ioapic_ops;
+	}
+
+	cons_printf("IRQs delivered by %s\n", s_irq_ops->name);
 }
 
 void irq_install_handler(int irq, int_handler_t *handler)
@@ -86,20 +182,7 @@ irq_mask_t irq_get_mask(void)
 
 void irq_set_mask(irq_mask_t mask)
 {
-	u8_t oldmask, newmask;
-
-	oldmask = MASTER(s_irqmask);
-	newmask = MASTER(mask);
-	if (newmask != oldmask) {
-		ioport_outb(0x21, newmask);
-	}
-
-	oldmask = SLAVE(s_irqmask);
-	newmask = SLAVE(mask);
-	if (newmask != oldmask) {
-		ioport_outb(0xA1, newmask);
-	}
-
+	s_irq_ops->set_mask(s_irqmask, mask);
 	s_irqmask = mask;
 }
 
@@ -131,16 +214,15 @@ void irq_begin(struct thread_context *context)
 void irq_end(struct thread_context *context)
 {
 	int irq = context->int_num - FIRST_IRQ;
-	u8_t command = 0x60 | (irq & 0x7);
 
 	KASSERT(VALID_IRQ(irq));
 
-	if (irq < 8) {
-		/* Specific EOI to master PIC */
-		ioport_outb(0x20, command);
-	} else {
-		/* Specific EOI to slave PIC, then to master (cascade line) */
-		ioport_outb(0xA0, command);
-		ioport_outb(0x20, 0x62);
-	}
+	s_irq_ops->eoi(irq);
+}
+
+int irq_get_number(struct thread_context *context)
+{
+	int irq = context->int_num - FIRST_IRQ;
+	KASSERT(VALID_IRQ(irq));
+	return irq;
 }
@@ -35,6 +35,7 @@
 
 #include <geekos/queue.h>
 #include <geekos/irq.h>
+#include <geekos/softirq.h>
 #include <arch/ioport.h>
 #include <arch/ps2.h>
 #include <geekos/keyboard.h> /* implement keyboard_init */
@@ -86,6 +87,13 @@
 #define CTRL_MASK   (LEFT_CTRL | RIGHT_CTRL)
 #define ALT_MASK    (LEFT_ALT | RIGHT_ALT)
 static unsigned s_shiftstate = 0;
+
+/* Raw scan codes queued by the interrupt handler for the tasklet. */
+#define SCAN_RING_SIZE 32
+#define SCAN_RING_MASK (SCAN_RING_SIZE - 1)
+static u8_t s_scan_ring[SCAN_RING_SIZE];
+static int s_scan_head, s_scan_tail;
+static struct tasklet s_keyb_tasklet;
 #define KEY_ESCAPE  0xE0
 
 /* Translate from scan code to key code, when shift is not pressed. */
@@ -145,24 +153,17 @@ static const u16_t s_scan_table_with_shift[] = {
     KEY_UNKNOWN, KEY_UNKNOWN, KEY_UNKNOWN     /* 0x58 - 0x0A */
 };
 
-static void keyboard_int_handler(struct thread_context *context)
+/*
+ * Translate a scan code into a keycode, and queue it for consumers.
+ * Runs in the keyboard tasklet, with interrupts enabled.
+ */
+static void keyboard_process_scan_code(u8_t scan_code)
 {
-    u8_t status, scan_code;
     unsigned flag = 0;
-    bool release = false, shift;
+    bool release = false, shift, iflag;
     /* bool specialkey = false; */
     u16_t keycode;
 
-    irq_begin(context);
-
-    status = ioport_inb(PS2_COMMAND);
-    ioport_delay();
-
-    if ((status & PS2_OUTPUT_FULL) != 0) {
-	/* There is a byte available */
-	scan_code = ioport_inb(PS2_DATA);
-	ioport_delay();
-
         if (scan_code == KEY_ESCAPE) {
             /*specialkey = true;*/
 	    goto done;
@@ -233,20 +234,71 @@ noflagchange:
 	if (release)
 	    keycode |= KEY_RELEASE_FLAG;
 		
-	/* Put the keycode in the buffer */
+	/* Put the keycode in the buffer, and wake up event consumers */
+	iflag = int_begin_atomic();
 	enqueue(keycode);
-
-	/* Wake up event consumers */
 	thread_wakeup(&s_waitqueue);
+	poll_wakeup(&s_poll_waitqueue, POLLIN);
 
 	/*
 	 * Pick a new thread upon return from interrupt
 	 * (hopefully the one waiting for the keyboard event)
 	 */
-	g_need_reschedule = true;
-    }
+	percpu_write(g_need_reschedule, true);
+	int_end_atomic(iflag);
 
 done:
+    return;
+}
+
+/*
+ * Keyboard bottom half: process the scan codes queued
+ * by the interrupt handler.
+ */
+static void keyboard_tasklet_func(ulong_t data)
+{
+    u8_t scan_code;
+
+    while (true) {
+	int_disable();
+	if (s_scan_head == s_scan_tail) {
+	    int_enable();
+	    break;
+	}
+	scan_code = s_scan_ring[s_scan_head];
+	s_scan_head = (s_scan_head + 1) & SCAN_RING_MASK;
+	int_enable();
+
+	keyboard_process_scan_code(scan_code);
+    }
+}
+
+/*
+ * Keyboard top half: read the scan code and defer
+ * its processing to the keyboard tasklet.
+ */
+static void keyboard_int_handler(struct thread_context *context)
+{
+    u8_t status, scan_code;
+
+    irq_begin(context);
+
+    status = ioport_inb(PS2_COMMAND);
+    ioport_delay();
+
+    if ((status & PS2_OUTPUT_FULL) != 0) {
+	/* There is a byte available */
+	scan_code = ioport_inb(PS2_DATA);
+	ioport_delay();
+
+	/* queue it (dropping it if the ring is full) */
+	if (((s_scan_tail + 1) & SCAN_RING_MASK) != s_scan_head) {
+	    s_scan_ring[s_scan_tail] = scan_code;
+	    s_scan_tail = (s_scan_tail + 1) & SCAN_RING_MASK;
+	}
+	tasklet_schedule(&s_keyb_tasklet);
+    }
+
     irq_end(context);
 }
 
@@ -266,13 +318,14 @@ void keyboard_init(void)
 
 	/* Buffer is initially empty. */
 	s_queue_head = s_queue_tail = 0;
+	s_scan_head = s_scan_tail = 0;
+	tasklet_init(&s_keyb_tasklet, &keyboard_tasklet_func, 0);
 
 	/* Install interrupt handler */
         irq_install_handler(KEYB_IRQ, &keyboard_int_handler);
 	irq_enable(KEYB_IRQ);
 
 	int_enable();
-	g_preemption = true;
 	cons_printf(".... [OK]\n");
 }
 
@@ -0,0 +1,126 @@
+/*
+ * GeekOS - x86 CMOS real-time clock
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <geekos/irq.h>
+#include <geekos/int.h>
+#include <geekos/thread.h>
+#include <geekos/timer.h>
+#include <geekos/cons.h>
+#include <arch/ioport.h>
+#include <arch/rtc.h>
+
+/*
+ * NOTES:
+ * - The RTC's periodic interrupt is handled by a threaded IRQ.
+ *   The top half only reads register C, which acknowledges the
+ *   interrupt; the IRQ thread does the rest.
+ * - At boot, rtc_init() checks that a burst of periodic interrupts
+ *   reaches the IRQ thread, then turns the periodic interrupt off.
+ *   Nothing else uses the RTC yet.
+ */
+
+/* periodic rate 6 is 1024 Hz */
+#define RTC_TEST_RATE        6
+#define RTC_TEST_INTERRUPTS  16
+#define RTC_TEST_TIMEOUT_MS  100
+
+/* periodic interrupts seen by the IRQ thread */
+static volatile int s_rtc_count;
+
+/*
+ * Read or write a CMOS register.  Interrupts must be disabled,
+ * since the index and data ports are used in sequence.
+ */
+static u8_t rtc_read(u8_t reg)
+{
+	ioport_outb(RTC_INDEX_PORT, RTC_NMI_DISABLE | reg);
+	return ioport_inb(RTC_DATA_PORT);
+}
+
+static void rtc_write(u8_t reg, u8_t value)
+{
+	ioport_outb(RTC_INDEX_PORT, RTC_NMI_DISABLE | reg);
+	ioport_outb(RTC_DATA_PORT, value);
+}
+
+/*
+ * Turn the periodic interrupt on or off.
+ */
+static void rtc_set_periodic(bool enabled)
+{
+	bool iflag = int_begin_atomic();
+	u8_t regb = rtc_read(RTC_REG_B);
+
+	regb = enabled ? (regb | RTC_REGB_PIE) : (regb & ~RTC_REGB_PIE);
+	rtc_write(RTC_REG_B, regb);
+	rtc_read(RTC_REG_C);            /* discard a stale interrupt flag */
+	int_end_atomic(iflag);
+}
+
+/*
+ * Top half: acknowledge the interrupt by reading register C
+ * (the RTC does not interrupt again until it has been read),
+ * and wake the IRQ thread if it was a periodic interrupt.
+ */
+static bool rtc_top_half(int irq, void *data)
+{
+	return (rtc_read(RTC_REG_C) & RTC_REGC_PF) != 0;
+}
+
+/*
+ * IRQ thread function: count the interrupt, and stop the
+ * periodic interrupt once the boot check has seen enough.
+ */
+static void rtc_irq_thread(int irq, void *data)
+{
+	if (++s_rtc_count == RTC_TEST_INTERRUPTS) {
+		rtc_set_periodic(false);
+	}
+}
+
+void rtc_init(void)
+{
+	int rc, waited;
+	bool iflag;
+
+	cons_printf("Initialize RTC .................");
+
+	rc = irq_request_threaded(RTC_IRQ, &rtc_top_half, &rtc_irq_thread, 0, THREAD_PRIO_IRQ);
+	if (rc != 0) {
+		cons_printf(".... [Failed]\n");
+		return;
+	}
+
+	iflag = int_begin_atomic();
+	rtc_write(RTC_REG_A, (rtc_read(RTC_REG_A) & ~RTC_REGA_RATE_MASK) | RTC_TEST_RATE);
+	int_end_atomic(iflag);
+	rtc_set_periodic(true);
+
+	for (waited = 0; s_rtc_count < RTC_TEST_INTERRUPTS && waited < RTC_TEST_TIMEOUT_MS; waited += 10) {
+		thread_sleep(TIMER_MS_TO_TICKS(10));
+	}
+
+	if (s_rtc_count < RTC_TEST_INTERRUPTS) {
+		rtc_set_periodic(false);
+		cons_printf(".... [Failed]\n");
+	} else {
+		cons_printf(".... [OK]\n");
+	}
+}
@@ -47,6 +47,7 @@ void thread_dump_context(struct thread_context *context)
  */
 static void thread_run(thread_func_t *start_func, ulong_t arg)
 {
+	percpu_write(g_preempt_count, 0); /* new threads start preemptible */
 	int_enable(); /* make sure interrupts are enabled */
 	start_func(arg);
 	thread_exit(0);
@@ -71,11 +72,11 @@ void thread_bootstrap(struct thread *thread, thread_func_t *start_func, ulong_t
 	 * We want to set up the thread's kernel stack to look like this:
 	 *
 	 * [lower addresses]
-	 *  +----------+  <-- ESP (points to beginning of thread_context)
-	 *  |          |
-	 *  | thread_  |
-	 *  | context  |  [EIP is &thread_run, ds/es are KERN_DS]
-	 *  |          |
+	 *  +----------+  <-- ESP
+	 *  |    0     |  [edi, esi, ebx, ebp]
+	 *  |   ...    |
+	 *  +----------+
+	 *  | &thr_run |  [return address of thread_switch_to]
 	 *  +----------+
 	 *  |    0     |  [fake return address]
 	 *  +----------+
@@ -85,34 +86,24 @@ void thread_bootstrap(struct thread *thread, thread_func_t *start_func, ulong_t
 	 *  +----------+
 	 * [higher addresses]
 	 *
-	 * Basically, we're making it look like the thread was interrupted
-	 * just before it got a chance to start executing thread_run().
+	 * Basically, we're making it look like the thread called
+	 * thread_switch_to() just before it got a chance to start
+	 * executing thread_run().  It starts with interrupts disabled,
+	 * as thread_switch_to() is always called with interrupts disabled.
 	 */
+	int i;
 
 	/* set up empty stack */
-	thread->stack_ptr = (ulong_t) (((u8_t*) thread->stack) + THREAD_STACK_SIZE);
+	thread->stack_ptr = (ulong_t) (((u8_t*) thread->stack) + thread->stack_size);
 
 	/* push thread_run arguments and (fake) return address */
 	thread_stack_push(thread, (u32_t) arg);
 	thread_stack_push(thread, (u32_t) start_func);
 	thread_stack_push(thread, 0);
 
-	/* create the thread_context */
-	{
-		struct thread_context *context;
-
-		/* push the thread_context and clear it */
-		thread->stack_ptr -= sizeof(struct thread_context);
-		context = (struct thread_context *) thread->stack_ptr;
-		memset(context, '\0', sizeof(struct thread_context));
-
-		/* set up registers */
-		context->gs = KERN_DS;
-		context->fs = KERN_DS;
-		context->es = KERN_DS;
-		context->ds = KERN_DS;
-		context->eip = (u32_t) &thread_run;
-		context->cs = KERN_CS;
-		context->eflags = 0UL; /* thread starts with interrupts disabled */
+	/* push the switch frame */
+	thread_stack_push(thread, (u32_t) &thread_run);
+	for (i = 0; i < 4; i++) {
+		thread_stack_push(thread, 0);
 	}
 }
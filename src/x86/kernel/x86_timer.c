@@ -20,10 +20,81 @@
 
 #include <geekos/timer.h>
 #include <geekos/irq.h>
+#include <geekos/int.h>
 #include <geekos/cons.h>
+#include <geekos/kassert.h>
+#include <arch/ioport.h>
+#include <arch/pit.h>
+#include <arch/apic.h>
+
+/*
+ * The timer interrupt is generated either by the local APIC timer
+ * (when the APICs are in use) or by channel 0 of the 8253/8254 PIT.
+ * Normally it runs periodically at TIMER_HZ; while the tick is
+ * stopped, it runs as a one-shot.
+ *
+ * PIT channel 2 is used as a reference delay for calibrating
+ * the local APIC timer (and the TSC).
+ */
 
 #define TIMER_IRQ 0
 
+/* PIT count for one tick */
+#define PIT_LATCH ((PIT_FREQ + TIMER_HZ/2) / TIMER_HZ)
+
+#if PIT_LATCH > 65535 || PIT_LATCH < 1
+#  error "TIMER_HZ is out of range for the PIT"
+#endif
+
+/* local APIC timer calibration interval in milliseconds, and in PIT counts */
+#define LAPIC_CAL_MS    10
+#define LAPIC_CAL_LATCH (PIT_FREQ / (1000 / LAPIC_CAL_MS))
+
+/* longest interval for which the tick may be stopped */
+#define TIMER_MAX_ONESHOT_TICKS 1000
+
+/* give up if channel 2 doesn't expire within this many polls */
+#define PIT_CH2_MAX_POLLS 10000000UL
+
+/* true if the local APIC timer generates the tick */
+static bool s_use_lapic;
+
+/* local APIC timer count for one tick */
+static u32_t s_lapic_count;
+
+/* count programmed for the current one-shot interval */
+static u32_t s_oneshot_count;
+
+/*
+ * Timer counts left over from earlier stopped intervals that did not
+ * add up to a whole tick; carried into the next restart so that
+ * g_numticks does not drift behind real time.
+ */
+static u32_t s_subtick_count;
+
+static void pit_program(u8_t cmd, u32_t count)
+{
+	ioport_outb(PIT_CMD_PORT, cmd);
+	ioport_outb(PIT_CH0_PORT, count & 0xff);
+	ioport_outb(PIT_CH0_PORT, (count >> 8) & 0xff);
+}
+
+static u32_t pit_read_count(void)
+{
+	u32_t lo, hi;
+	ioport_outb(PIT_CMD_PORT, PIT_CMD_CH0_LATCH);
+	lo = ioport_inb(PIT_CH0_PORT);
+	hi = ioport_inb(PIT_CH0_PORT);
+	return (hi << 8) | lo;
+}
+
+static void lapic_timer_program(u32_t mode, u32_t count)
+{
+	lapic_write(LAPIC_TIMER_DCR, LAPIC_TIMER_DIV_16);
+	lapic_write(LAPIC_LVT_TIMER, mode | LAPIC_TIMER_VECTOR);
+	lapic_write(LAPIC_TIMER_ICR, count);
+}
+
 static void timer_int_handler(struct thread_context *context)
 {
 	irq_begin(context);
@@ -31,18 +102,179 @@ static void timer_int_handler(struct thread_context *context)
 	irq_end(context);
 }
 
+static void lapic_timer_int_handler(struct thread_context *context)
+{
+	timer_process_tick();
+	lapic_eoi();
+}
+
+/*
+ * Measure the number of local APIC timer counts per tick.
+ * Returns 0 if the measurement fails.
+ */
+static u32_t lapic_timer_calibrate(void)
+{
+	u8_t gate;
+	u32_t counts;
+	bool ok;
+
+	lapic_timer_program(LAPIC_LVT_MASKED, 0xFFFFFFFFUL);
+	gate = pit_ch2_start(LAPIC_CAL_LATCH);
+	ok = pit_ch2_wait();
+	counts = 0xFFFFFFFFUL - lapic_read(LAPIC_TIMER_CCR);
+	pit_ch2_stop(gate);
+	lapic_write(LAPIC_TIMER_ICR, 0);
+
+	if (!ok) {
+		return 0;
+	}
+	return (counts * (1000 / LAPIC_CAL_MS)) / TIMER_HZ;
+}
+
+/*
+ * Start PIT channel 2 counting down once from given count.
+ * Returns the previous value of the gate port, to be
+ * passed to pit_ch2_stop().  Interrupts should be disabled.
+ */
+u8_t pit_ch2_start(u32_t count)
+{
+	u8_t gate = ioport_inb(PIT_CH2_GATE_PORT);
+
+	/* enable channel 2 gate, disconnect the speaker */
+	ioport_outb(PIT_CH2_GATE_PORT, (gate & ~PIT_SPEAKER_DATA) | PIT_CH2_GATE);
+
+	/* channel 2 counts down once; its output goes high at 0 */
+	ioport_outb(PIT_CMD_PORT, PIT_CMD_CH2_ONESHOT);
+	ioport_outb(PIT_CH2_PORT, count & 0xff);
+	ioport_outb(PIT_CH2_PORT, (count >> 8) & 0xff);
+
+	return gate;
+}
+
+/*
+ * Wait for PIT channel 2 to reach 0.
+ * Returns false if it does not appear to be counting.
+ */
+bool pit_ch2_wait(void)
+{
+	ulong_t polls = 0;
+
+	while ((ioport_inb(PIT_CH2_GATE_PORT) & PIT_CH2_OUT) == 0) {
+		if (++polls > PIT_CH2_MAX_POLLS) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Restore the gate/speaker state saved by pit_ch2_start().
+ */
+void pit_ch2_stop(u8_t gate)
+{
+	ioport_outb(PIT_CH2_GATE_PORT, gate);
+}
+
+/*
+ * Maximum number of ticks for which the tick can be stopped.
+ */
+u32_t timer_max_oneshot_ticks(void)
+{
+	if (s_use_lapic) {
+		/* leave a tick of headroom for the carried sub-tick count */
+		u32_t max = 0xFFFFFFFFUL / s_lapic_count - 1;
+		return (max < TIMER_MAX_ONESHOT_TICKS) ? max : TIMER_MAX_ONESHOT_TICKS;
+	}
+	return 65535 / PIT_LATCH;
+}
+
+/*
+ * Stop the periodic tick, and arrange for a timer interrupt
+ * after given number of ticks.
+ * Interrupts must be disabled.
+ */
+void timer_stop_tick(u32_t ticks)
+{
+	KASSERT(!int_enabled());
+	KASSERT(ticks > 0 && ticks <= timer_max_oneshot_ticks());
+
+	if (s_use_lapic) {
+		s_oneshot_count = ticks * s_lapic_count;
+		lapic_timer_program(0, s_oneshot_count);
+	} else {
+		s_oneshot_count = ticks * PIT_LATCH;
+		pit_program(PIT_CMD_CH0_ONESHOT, s_oneshot_count);
+	}
+}
+
+/*
+ * Restart the periodic tick.  If expired is true, the one-shot interval
+ * ran to completion; otherwise, the tick is being restarted early.
+ * Returns the number of whole ticks that elapsed while it was stopped;
+ * the fraction of a tick left over is carried into the next call.
+ * Interrupts must be disabled.
+ */
+u32_t timer_restart_tick(bool expired)
+{
+	u32_t remaining, elapsed;
+
+	KASSERT(!int_enabled());
+
+	if (s_use_lapic) {
+		/* the one-shot current count stops at 0 */
+		remaining = expired ? 0 : lapic_read(LAPIC_TIMER_CCR);
+		elapsed = s_oneshot_count - remaining;
+		lapic_timer_program(LAPIC_TIMER_PERIODIC, s_lapic_count);
+
+		elapsed += s_subtick_count;
+		s_subtick_count = elapsed % s_lapic_count;
+		return elapsed / s_lapic_count;
+	}
+
+	if (expired) {
+		elapsed = s_oneshot_count;
+	} else {
+		/* after reaching 0, the counter wraps and keeps counting down */
+		remaining = pit_read_count();
+		if (remaining == 0 || remaining > s_oneshot_count) {
+			elapsed = s_oneshot_count;
+		} else {
+			elapsed = s_oneshot_count - remaining;
+		}
+	}
+
+	pit_program(PIT_CMD_CH0_PERIODIC, PIT_LATCH);
+
+	elapsed += s_subtick_count;
+	s_subtick_count = elapsed % PIT_LATCH;
+	return elapsed / PIT_LATCH;
+}
+
 void timer_init(void)
 {
 	cons_printf("Initialize timer ...............");
-	/*
-	 * FIXME: for now, just leave the default 18Hz periodic timer.
-	 */
-	irq_install_handler(TIMER_IRQ, &timer_int_handler);
-	irq_enable(TIMER_IRQ);
+
+	timer_softirq_init();
+
+	if (apic_is_enabled()) {
+		s_lapic_count = lapic_timer_calibrate();
+		s_use_lapic = (s_lapic_count > 0);
+	}
+
+	if (s_use_lapic) {
+		/* leave the PIT's IRQ masked, and use the local APIC timer */
+		int_install_handler(LAPIC_TIMER_VECTOR, &lapic_timer_int_handler);
+		lapic_timer_program(LAPIC_TIMER_PERIODIC, s_lapic_count);
+	} else {
+		/* program the PIT to interrupt at TIMER_HZ */
+		pit_program(PIT_CMD_CH0_PERIODIC, PIT_LATCH);
+		irq_install_handler(TIMER_IRQ, &timer_int_handler);
+		irq_enable(TIMER_IRQ);
+	}
 
 	/* now that we have a timer interrupt handler installed, we can
 	 * enable interrupt handling and preemption */
 	int_enable();
-	g_preemption = true;
-	cons_printf(".... [OK]\n");
+	preempt_enable();
+	cons_printf(".... [%s]\n", s_use_lapic ? "LAPIC" : "PIT");
 }
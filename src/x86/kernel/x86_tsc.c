@@ -0,0 +1,110 @@
+/*
+ * GeekOS - x86 time stamp counter clocksource
+ *
+ * Copyright (C) 2001-2008, David H. Hovemeyer <david.hovemeyer@gmail.com>
+ *
+ * This code is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 only, as
+ * published by the Free Software Foundation.
+ *   
+ * This code is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * version 2 for more details (a copy is included in the LICENSE file that
+ * accompanied this code).
+ *  
+ * You should have received a copy of the GNU General Public License version
+ * 2 along with this work; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <geekos/ktime.h>
+#include <geekos/int.h>
+#include <geekos/range.h>
+#include <geekos/cons.h>
+#include <arch/cpu.h>
+#include <arch/pit.h>
+
+/*
+ * NOTES:
+ * - The TSC frequency is measured by counting TSC cycles while
+ *   PIT channel 2 counts down a known interval.  Channel 2 is
+ *   independent of the timer interrupt on channel 0.
+ * - A TSC which is not invariant may change rate with the CPU
+ *   clock; it is given a lower rating and left to the watchdog.
+ */
+
+/* calibration interval in milliseconds, and in PIT counts */
+#define TSC_CAL_MS    10
+#define TSC_CAL_LATCH (PIT_FREQ / (1000 / TSC_CAL_MS))
+
+/* number of calibration runs (the shortest is used) */
+#define TSC_CAL_RUNS  3
+
+static u64_t tsc_read(struct clocksource *cs)
+{
+	return x86_rdtsc();
+}
+
+static struct clocksource s_tsc_clocksource = {
+	.name = "tsc",
+	.read = &tsc_read,
+	.mask = ~0ULL,
+};
+
+/*
+ * Measure the number of TSC cycles in TSC_CAL_MS milliseconds.
+ * Returns 0 if PIT channel 2 does not appear to work.
+ */
+static u64_t tsc_calibrate_once(void)
+{
+	bool iflag, ok;
+	u8_t gate;
+	u64_t start, end;
+
+	iflag = int_begin_atomic();
+
+	gate = pit_ch2_start(TSC_CAL_LATCH);
+	start = x86_rdtsc();
+	ok = pit_ch2_wait();
+	end = x86_rdtsc();
+	pit_ch2_stop(gate);
+
+	int_end_atomic(iflag);
+
+	return ok ? end - start : 0;
+}
+
+/*
+ * Calibrate the TSC and register it as a clocksource.
+ */
+void clocksource_arch_init(void)
+{
+	struct x86_cpuid_info cpuid;
+	u64_t cycles, best = 0;
+	u32_t khz;
+	int i;
+
+	if (!x86_cpuid(&cpuid) || !cpuid.feature_info_edx.tsc) {
+		return;
+	}
+
+	for (i = 0; i < TSC_CAL_RUNS; i++) {
+		cycles = tsc_calibrate_once();
+		if (cycles == 0) {
+			return;
+		}
+		if (best == 0 || cycles < best) {
+			best = cycles;
+		}
+	}
+
+	khz = (u32_t) range_div_u64_u32(best, TSC_CAL_MS);
+	if (khz == 0) {
+		return;
+	}
+
+	clocksource_set_freq_khz(&s_tsc_clocksource, khz);
+	s_tsc_clocksource.rating = cpuid.apm_info_edx.invariant_tsc ? 300 : 200;
+	clocksource_register(&s_tsc_clocksource);
+}
@@ -23,6 +23,7 @@
 #include <geekos/string.h>
 #include <geekos/vm.h>
 #include <arch/cpu.h>
+#include <arch/apic.h>
 
 #define IS_PT_SPAN_ALIGNED(addr) (((addr) & 0xFFC00000) == (addr))
 
@@ -163,6 +164,13 @@ void vm_init_paging(struct multiboot_info *boot_info)
 		vm_set_pde_4m(s_kernel_pagedir, VM_WRITE|VM_READ|VM_EXEC, paddr, paddr);
 	}
 
+	/*
+	 * Identity-map the (uncached) local APIC and I/O APIC registers.
+	 */
+	for (paddr = APIC_MMIO_BASE; paddr < APIC_MMIO_BASE + APIC_MMIO_SIZE; paddr += VM_PT_SPAN) {
+		vm_set_pde_4m(s_kernel_pagedir, VM_WRITE|VM_READ|VM_NOCACHE, paddr, paddr);
+	}
+
 	/*
 	 * Turn on paging!
 	 */